@@ -0,0 +1,217 @@
+/* ScummVM - Graphic Adventure Engine
+ *
+ * ScummVM is the legal property of its developers, whose names
+ * are too numerous to list here. Please refer to the COPYRIGHT
+ * file distributed with this source distribution.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+ *
+ */
+
+#include "common/debug.h"
+#include "common/memstream.h"
+#include "common/stream.h"
+#include "common/system.h"
+#include "common/textconsole.h"
+#include "graphics/surface.h"
+
+#include "director/bitd.h"
+#include "director/expand.h"
+#include "director/surfacepool.h"
+
+namespace Director {
+
+static uint16 getRowBytes(uint16 width, uint8 bitsPerPixel) {
+	return ((width * bitsPerPixel + 15) / 16) * 2;
+}
+
+BITDDecoder::BITDDecoder(uint16 width, uint16 height, SurfacePool *pool, CastExpanders *expanders) {
+	_width = width;
+	_height = height;
+	_bitsPerPixel = 0;
+	_pool = pool;
+	_expanders = expanders;
+	_surface = nullptr;
+}
+
+BITDDecoder::~BITDDecoder() {
+	destroy();
+}
+
+void BITDDecoder::destroy() {
+	_pool->release(_surface);
+	_surface = nullptr;
+	_bitsPerPixel = 0;
+}
+
+bool BITDDecoder::loadStream(Common::SeekableReadStream &stream) {
+	destroy();
+
+	if (!_width || !_height)
+		return false;
+
+	uint32 start = g_system->getMillis();
+
+	//Shared cast streams are decoded again every time they are shown
+	stream.seek(0);
+
+	//8-bit rows are the widest, so every depth can be unpacked in place
+	uint16 pitch = getRowBytes(_width, 8);
+	uint32 capacity = pitch * _height;
+	uint32 size = stream.size();
+
+	_surface = _pool->acquire(_width, _height, pitch);
+	byte *pixels = (byte *)_surface->getPixels();
+	uint32 len = 0;
+
+	for (uint8 bpp = 8; bpp; bpp >>= 1) {
+		if (size == (uint32)getRowBytes(_width, bpp) * _height) {
+			_bitsPerPixel = bpp;
+			break;
+		}
+	}
+
+	if (_bitsPerPixel) {
+		len = stream.read(pixels, size);
+	} else {
+		while (!stream.eos() && stream.pos() < (int32)size && len < capacity) {
+			int8 n = stream.readSByte();
+
+			if (n >= 0) {
+				uint32 count = MIN<uint32>(n + 1, capacity - len);
+				stream.read(pixels + len, count);
+				stream.skip(n + 1 - count);
+				len += count;
+			} else if (n != -128) {
+				uint32 count = MIN<uint32>(1 - n, capacity - len);
+				memset(pixels + len, stream.readByte(), count);
+				len += count;
+			}
+		}
+
+		uint16 rowBytes = len / _height;
+
+		for (uint8 bpp = 8; bpp; bpp >>= 1) {
+			if (rowBytes == getRowBytes(_width, bpp)) {
+				_bitsPerPixel = bpp;
+				break;
+			}
+		}
+
+		if (!_bitsPerPixel) {
+			warning("BITD: %d bytes unpacked for a %dx%d bitmap", len, _width, _height);
+
+			_bitsPerPixel = 1;
+
+			while (_bitsPerPixel < 8 && getRowBytes(_width, _bitsPerPixel * 2) <= rowBytes)
+				_bitsPerPixel *= 2;
+		}
+	}
+
+	uint16 rowBytes = getRowBytes(_width, _bitsPerPixel);
+
+	//Short data leaves the rest of the bitmap blank
+	if (len < (uint32)rowBytes * _height)
+		memset(pixels + len, 0, rowBytes * _height - len);
+
+	if (_bitsPerPixel < 8) {
+		//Expanding the last row first never overwrites packed rows still to be read
+		const PixelExpander &expander = _expanders->get(_bitsPerPixel);
+
+		for (int y = _height - 1; y >= 0; y--)
+			expander.expandRow(pixels + y * pitch, pixels + y * rowBytes, _width);
+	}
+
+	debug(3, "BITD %dx%d, %d bpp, %d bytes decoded in %d ms", _width, _height, _bitsPerPixel, size, g_system->getMillis() - start);
+
+	return true;
+}
+
+static uint32 packBits(byte *dst, const byte *src, uint32 size) {
+	uint32 len = 0;
+	uint32 i = 0;
+
+	while (i < size) {
+		uint32 run = 1;
+
+		while (i + run < size && run < 128 && src[i + run] == src[i])
+			run++;
+
+		if (run > 1) {
+			dst[len++] = (byte)(1 - run);
+			dst[len++] = src[i];
+			i += run;
+			continue;
+		}
+
+		uint32 literal = 1;
+
+		while (i + literal < size && literal < 128 && (i + literal + 1 >= size || src[i + literal] != src[i + literal + 1]))
+			literal++;
+
+		dst[len++] = literal - 1;
+		memcpy(dst + len, src + i, literal);
+		len += literal;
+		i += literal;
+	}
+
+	return len;
+}
+
+void benchmarkDecoders() {
+	//A cast sized bitmap with runs and noise, as scanned art and
+	//flat fills mix in real movies
+	const uint16 width = 320;
+	const uint16 height = 240;
+	const int rounds = 50;
+
+	SurfacePool pool;
+	CastExpanders expanders;
+
+	for (uint8 bpp = 1; bpp <= 8; bpp *= 8) {
+		uint32 size = getRowBytes(width, bpp) * height;
+		byte *raw = new byte[size];
+		byte *packed = new byte[size + size / 128 + 1];
+
+		for (uint32 i = 0; i < size; i++)
+			raw[i] = (i / 24) & 1 ? (byte)(i * 37 ^ i >> 5) : (byte)(i / 96);
+
+		uint32 packedSize = packBits(packed, raw, size);
+
+		for (int pooled = 1; pooled >= 0; pooled--) {
+			BITDDecoder decoder(width, height, &pool, &expanders);
+			uint32 start = g_system->getMillis();
+
+			for (int r = 0; r < rounds; r++) {
+				Common::MemoryReadStream stream(packed, packedSize);
+				decoder.loadStream(stream);
+				decoder.destroy();
+
+				if (!pooled)
+					pool.clear();
+			}
+
+			uint32 elapsed = MAX<uint32>(g_system->getMillis() - start, 1);
+
+			debug("BITD %d bpp, %d to %d bytes, %s: %d pixels per ms", bpp, size, packedSize,
+				pooled ? "pooled" : "allocated", (uint32)width * height * rounds / elapsed);
+		}
+
+		delete[] raw;
+		delete[] packed;
+	}
+}
+
+} // End of namespace Director
@@ -0,0 +1,71 @@
+/* ScummVM - Graphic Adventure Engine
+ *
+ * ScummVM is the legal property of its developers, whose names
+ * are too numerous to list here. Please refer to the COPYRIGHT
+ * file distributed with this source distribution.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+ *
+ */
+
+#ifndef DIRECTOR_BITD_H
+#define DIRECTOR_BITD_H
+
+#include "common/scummsys.h"
+#include "image/image_decoder.h"
+
+namespace Common {
+class SeekableReadStream;
+}
+
+namespace Graphics {
+struct Surface;
+}
+
+namespace Director {
+
+class CastExpanders;
+class SurfacePool;
+
+// Director's own bitmap format: rows of 1, 2, 4 or 8 bit pixels padded to
+// an even length, usually PackBits compressed, with no header. The size
+// comes from the cast, the depth from the amount of data.
+class BITDDecoder : public Image::ImageDecoder {
+public:
+	BITDDecoder(uint16 width, uint16 height, SurfacePool *pool, CastExpanders *expanders);
+	virtual ~BITDDecoder();
+
+	// ImageDecoder API
+	void destroy();
+	virtual bool loadStream(Common::SeekableReadStream &stream);
+	virtual const Graphics::Surface *getSurface() const { return _surface; }
+	uint8 getBitsPerPixel() const { return _bitsPerPixel; }
+
+private:
+	uint16 _width;
+	uint16 _height;
+	uint8 _bitsPerPixel;
+	SurfacePool *_pool;
+	CastExpanders *_expanders;
+	Graphics::Surface *_surface;
+};
+
+// Logs PackBits decode throughput of 1 and 8-bit bitmaps, with buffers
+// recycled by the pool and with every buffer freshly allocated
+void benchmarkDecoders();
+
+} // End of namespace Director
+
+#endif
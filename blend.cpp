@@ -0,0 +1,277 @@
+/* ScummVM - Graphic Adventure Engine
+ *
+ * ScummVM is the legal property of its developers, whose names
+ * are too numerous to list here. Please refer to the COPYRIGHT
+ * file distributed with this source distribution.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+ *
+ */
+
+#include "common/debug.h"
+#include "common/system.h"
+#include "common/util.h"
+
+#include "graphics/pixelformat.h"
+
+#include "director/blend.h"
+
+namespace Director {
+
+// Tables are 64K each, keep the ones for a few palettes and blend levels.
+// Inverse maps are 32K, movies seldom switch between more palettes than that
+#define MAX_BLEND_TABLES 8
+#define MAX_INVERSE_MAPS 4
+
+static uint32 hashPalette(const byte *palette, uint16 colorCount) {
+	uint32 hash = 2166136261u ^ colorCount;
+
+	for (uint i = 0; i < colorCount * 3u; i++)
+		hash = (hash ^ palette[i]) * 16777619u;
+
+	return hash;
+}
+
+static int blendChannel(InkType ink, int src, int dst, int level) {
+	switch (ink) {
+	case kInkTypeBlend:
+		return (src * level + dst * (100 - level)) / 100;
+	case kInkTypeAddPin:
+		return MIN(src + dst, 255);
+	case kInkTypeAdd:
+		return (src + dst) & 0xff;
+	case kInkTypeSubPin:
+		return MAX(dst - src, 0);
+	case kInkTypeSub:
+		return (dst - src) & 0xff;
+	case kInkTypeLight:
+		return MAX(src, dst);
+	case kInkTypeDark:
+		return MIN(src, dst);
+	default:
+		return src;
+	}
+}
+
+BlendTableCache::BlendTableCache() {
+	_paletteVersion = 0;
+	_paletteHash = 0;
+	_paletteHashed = false;
+}
+
+BlendTableCache::~BlendTableCache() {
+	clear();
+}
+
+void BlendTableCache::clear() {
+	for (uint i = 0; i < _tables.size(); i++)
+		delete[] _tables[i].table;
+
+	_tables.clear();
+
+	for (uint i = 0; i < _inverseMaps.size(); i++)
+		delete[] _inverseMaps[i].map;
+
+	_inverseMaps.clear();
+	_paletteHashed = false;
+}
+
+const byte *BlendTableCache::getTable(uint32 paletteVersion, const byte *palette, uint16 colorCount, InkType ink, byte blend) {
+	if (!_paletteHashed || _paletteVersion != paletteVersion) {
+		_paletteHash = hashPalette(palette, colorCount);
+		_paletteVersion = paletteVersion;
+		_paletteHashed = true;
+	}
+
+	uint32 hash = _paletteHash;
+
+	//Only the blend ink depends on the blend level
+	if (ink != kInkTypeBlend)
+		blend = 0;
+
+	for (uint i = 0; i < _tables.size(); i++) {
+		if (_tables[i].paletteHash == hash && _tables[i].ink == ink && _tables[i].blend == blend)
+			return _tables[i].table;
+	}
+
+	if (_tables.size() >= MAX_BLEND_TABLES) {
+		delete[] _tables[0].table;
+		_tables.remove_at(0);
+	}
+
+	const byte *inverseMap = getInverseMap(hash, palette, colorCount);
+
+	BlendTable t;
+	t.paletteHash = hash;
+	t.ink = ink;
+	t.blend = blend;
+	t.table = new byte[256 * 256];
+
+	uint32 start = g_system->getMillis();
+	buildTable(t, inverseMap, palette, colorCount);
+	debug(2, "Blend table for ink %d, blend %d built in %d ms", ink, blend, g_system->getMillis() - start);
+
+	_tables.push_back(t);
+
+	return t.table;
+}
+
+const byte *BlendTableCache::getInverseMap(uint32 hash, const byte *palette, uint16 colorCount) {
+	for (uint i = 0; i < _inverseMaps.size(); i++) {
+		if (_inverseMaps[i].paletteHash == hash)
+			return _inverseMaps[i].map;
+	}
+
+	if (_inverseMaps.size() >= MAX_INVERSE_MAPS) {
+		delete[] _inverseMaps[0].map;
+		_inverseMaps.remove_at(0);
+	}
+
+	InverseMap m;
+	m.paletteHash = hash;
+	m.map = new byte[32768];
+
+	uint32 start = g_system->getMillis();
+
+	for (int rgb = 0; rgb < 32768; rgb++) {
+		int r = ((rgb >> 10) & 0x1f) << 3 | 4;
+		int g = ((rgb >> 5) & 0x1f) << 3 | 4;
+		int b = (rgb & 0x1f) << 3 | 4;
+		uint32 bestDistance = 0xffffffff;
+		byte best = 0;
+
+		for (uint16 i = 0; i < colorCount; i++) {
+			int dr = r - palette[i * 3 + 0];
+			int dg = g - palette[i * 3 + 1];
+			int db = b - palette[i * 3 + 2];
+			uint32 distance = dr * dr + dg * dg + db * db;
+
+			if (distance < bestDistance) {
+				bestDistance = distance;
+				best = i;
+			}
+		}
+
+		m.map[rgb] = best;
+	}
+
+	debug(2, "Inverse palette map for %d colors built in %d ms", colorCount, g_system->getMillis() - start);
+
+	_inverseMaps.push_back(m);
+
+	return m.map;
+}
+
+void BlendTableCache::buildTable(BlendTable &t, const byte *inverseMap, const byte *palette, uint16 colorCount) {
+	//Blend ink defaults to 50% when the frame has no blend level
+	int level = t.blend ? MIN<int>(t.blend, 100) : 50;
+
+	for (int src = 0; src < 256; src++) {
+		byte *row = t.table + (src << 8);
+
+		if (src >= colorCount) {
+			memset(row, src, 256);
+			continue;
+		}
+
+		const byte *s = palette + src * 3;
+
+		for (int dst = 0; dst < 256; dst++) {
+			if (dst >= colorCount) {
+				row[dst] = src;
+				continue;
+			}
+
+			const byte *d = palette + dst * 3;
+			int r = blendChannel(t.ink, s[0], d[0], level);
+			int g = blendChannel(t.ink, s[1], d[1], level);
+			int b = blendChannel(t.ink, s[2], d[2], level);
+
+			row[dst] = inverseMap[(r >> 3) << 10 | (g >> 3) << 5 | (b >> 3)];
+		}
+	}
+}
+
+void blendBlit(Graphics::Surface &target, const Graphics::Surface &sprite, const Common::Rect &srcRect, const Common::Point &dstPos, const byte *table) {
+	for (int ii = 0; ii < srcRect.height(); ii++) {
+		const byte *src = (const byte *)sprite.getBasePtr(srcRect.left, srcRect.top + ii);
+		byte *dst = (byte *)target.getBasePtr(dstPos.x, dstPos.y + ii);
+
+		for (int j = 0; j < srcRect.width(); j++) {
+			*dst = table[(*src << 8) | *dst];
+
+			src++;
+			dst++;
+		}
+	}
+}
+
+void benchmarkBlend() {
+	//A 256 color palette with ramps in every channel, a 640x480 stage
+	//and a 128x128 sprite blitted all over it
+	const uint16 stageWidth = 640;
+	const uint16 stageHeight = 480;
+	const uint16 spriteSize = 128;
+	const int rounds = 50;
+	static const InkType inks[] = { kInkTypeBlend, kInkTypeAddPin, kInkTypeAdd, kInkTypeSubPin, kInkTypeLight, kInkTypeSub, kInkTypeDark };
+
+	byte palette[768];
+
+	for (int i = 0; i < 256; i++) {
+		palette[i * 3 + 0] = (i & 0xe0) | (i >> 3 & 0x1f);
+		palette[i * 3 + 1] = (i << 3 & 0xe0) | (i & 0x1f);
+		palette[i * 3 + 2] = (i << 6 & 0xc0) | (i >> 2 & 0x3f);
+	}
+
+	Graphics::Surface stage;
+	Graphics::Surface sprite;
+	stage.create(stageWidth, stageHeight, Graphics::PixelFormat::createFormatCLUT8());
+	sprite.create(spriteSize, spriteSize, Graphics::PixelFormat::createFormatCLUT8());
+
+	for (int y = 0; y < stageHeight; y++)
+		for (int x = 0; x < stageWidth; x++)
+			*(byte *)stage.getBasePtr(x, y) = (x ^ y) & 0xff;
+
+	for (int y = 0; y < spriteSize; y++)
+		for (int x = 0; x < spriteSize; x++)
+			*(byte *)sprite.getBasePtr(x, y) = (x * 3 + y * 5) & 0xff;
+
+	BlendTableCache cache;
+	Common::Rect srcRect(spriteSize, spriteSize);
+
+	for (uint i = 0; i < ARRAYSIZE(inks); i++) {
+		//The first ink pays for the inverse map as well
+		uint32 start = g_system->getMillis();
+		const byte *table = cache.getTable(1, palette, 256, inks[i], 50);
+		uint32 build = g_system->getMillis() - start;
+
+		start = g_system->getMillis();
+
+		for (int r = 0; r < rounds; r++)
+			for (int y = 0; y + spriteSize <= stageHeight; y += spriteSize)
+				for (int x = 0; x + spriteSize <= stageWidth; x += spriteSize)
+					blendBlit(stage, sprite, srcRect, Common::Point(x, y), table);
+
+		uint32 elapsed = MAX<uint32>(g_system->getMillis() - start, 1);
+		uint32 pixels = (uint32)(stageWidth / spriteSize) * (stageHeight / spriteSize) * spriteSize * spriteSize * rounds;
+
+		debug("Blend ink %d: table built in %d ms, %d pixels per ms", inks[i], build, pixels / elapsed);
+	}
+
+	stage.free();
+	sprite.free();
+}
+
+} // End of namespace Director
@@ -0,0 +1,78 @@
+/* ScummVM - Graphic Adventure Engine
+ *
+ * ScummVM is the legal property of its developers, whose names
+ * are too numerous to list here. Please refer to the COPYRIGHT
+ * file distributed with this source distribution.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+ *
+ */
+
+#ifndef DIRECTOR_BLEND_H
+#define DIRECTOR_BLEND_H
+
+#include "common/array.h"
+#include "common/rect.h"
+#include "graphics/surface.h"
+
+#include "director/score.h"
+
+namespace Director {
+
+// Lookup tables for the arithmetic inks on 8-bit stages. A table maps
+// (sprite color << 8 | stage color) to the palette entry closest to the
+// result, so blending a pixel is a single load.
+class BlendTableCache {
+public:
+	BlendTableCache();
+	~BlendTableCache();
+
+	// paletteVersion changes whenever the palette does, so the palette is
+	// only hashed again when it changes
+	const byte *getTable(uint32 paletteVersion, const byte *palette, uint16 colorCount, InkType ink, byte blend);
+	void clear();
+
+private:
+	struct BlendTable {
+		uint32 paletteHash;
+		InkType ink;
+		byte blend;
+		byte *table;
+	};
+
+	struct InverseMap {
+		uint32 paletteHash;
+		byte *map; // 15-bit RGB to closest palette entry
+	};
+
+	const byte *getInverseMap(uint32 hash, const byte *palette, uint16 colorCount);
+	void buildTable(BlendTable &t, const byte *inverseMap, const byte *palette, uint16 colorCount);
+
+	Common::Array<BlendTable> _tables;
+	Common::Array<InverseMap> _inverseMaps;
+	uint32 _paletteVersion;
+	uint32 _paletteHash; // of the palette at _paletteVersion
+	bool _paletteHashed;
+};
+
+// Draws srcRect of sprite at dstPos through a table from BlendTableCache
+void blendBlit(Graphics::Surface &target, const Graphics::Surface &sprite, const Common::Rect &srcRect, const Common::Point &dstPos, const byte *table);
+
+// Logs table build times and blit throughput over fixed surfaces
+void benchmarkBlend();
+
+} // End of namespace Director
+
+#endif
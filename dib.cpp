@@ -33,14 +33,66 @@
 #include "common/debug.h"
 #include "image/codecs/bmp_raw.h"
 #include "common/system.h"
+#include "director/expand.h"
+#include "director/surfacepool.h"
 
 namespace Director {
 
-DIBDecoder::DIBDecoder() {
+// Codecs are small, but each holds a surface of its last frame
+#define MAX_CACHED_CODECS 8
+
+DIBCodecCache::DIBCodecCache() {
+}
+
+DIBCodecCache::~DIBCodecCache() {
+	clear();
+}
+
+void DIBCodecCache::clear() {
+	for (uint i = 0; i < _codecs.size(); i++)
+		delete _codecs[i].codec;
+
+	_codecs.clear();
+}
+
+Image::Codec *DIBCodecCache::getCodec(uint32 compression, uint32 width, uint32 height, uint16 bitsPerPixel) {
+	for (uint i = 0; i < _codecs.size(); i++) {
+		CodecEntry entry = _codecs[i];
+
+		if (entry.compression == compression && entry.width == width && entry.height == height && entry.bitsPerPixel == bitsPerPixel) {
+			_codecs.remove_at(i);
+			_codecs.push_back(entry);
+			return entry.codec;
+		}
+	}
+
+	Image::Codec *codec = Image::createBitmapCodec(compression, width, height, bitsPerPixel);
+
+	if (!codec)
+		return nullptr;
+
+	if (_codecs.size() >= MAX_CACHED_CODECS) {
+		delete _codecs[0].codec;
+		_codecs.remove_at(0);
+	}
+
+	CodecEntry entry;
+	entry.compression = compression;
+	entry.width = width;
+	entry.height = height;
+	entry.bitsPerPixel = bitsPerPixel;
+	entry.codec = codec;
+	_codecs.push_back(entry);
+
+	return codec;
+}
+
+DIBDecoder::DIBDecoder(SurfacePool *pool, DIBCodecCache *codecs) {
+	_pool = pool;
+	_codecs = codecs;
 	_surface = 0;
 	_palette = 0;
 	_paletteColorCount = 0;
-	_codec = 0;
 }
 
 DIBDecoder::~DIBDecoder() {
@@ -48,21 +100,19 @@ DIBDecoder::~DIBDecoder() {
 }
 
 void DIBDecoder::destroy() {
+	_pool->release(_surface);
 	_surface = 0;
 
 	delete[] _palette;
 	_palette = 0;
 	_paletteColorCount = 0;
-
-	delete _codec;
-	_codec = 0;
 }
 
 void DIBDecoder::loadPalette(Common::SeekableReadStream &stream) {
 	uint16 steps = stream.size() / 6;
 	uint16 index = (steps * 3) - 1;
 	_paletteColorCount = steps;
-	_palette = new byte[index];
+	_palette = new byte[steps * 3];
 
 	for (uint8 i = 0; i < steps; i++) {
 		_palette[index - 2] = stream.readByte();
@@ -78,6 +128,11 @@ void DIBDecoder::loadPalette(Common::SeekableReadStream &stream) {
 }
 
 bool DIBDecoder::loadStream(Common::SeekableReadStream &stream) {
+	destroy();
+
+	//Shared cast streams are decoded again every time they are shown
+	stream.seek(0);
+
 	uint32 headerSize = stream.readUint32LE();
 	if (headerSize != 40)
 		return false;
@@ -87,7 +142,7 @@ bool DIBDecoder::loadStream(Common::SeekableReadStream &stream) {
 	stream.readUint16LE(); // planes
 	uint16 bitsPerPixel = stream.readUint16LE();
 	uint32 compression = stream.readUint32BE();
-	uint32 imageSize = stream.readUint32LE();
+	/* uint32 imageSize = */ stream.readUint32LE();
 	/* uint32 pixelsPerMeterX = */ stream.readUint32LE();
 	/* uint32 pixelsPerMeterY = */ stream.readUint32LE();
 	_paletteColorCount = stream.readUint32LE();
@@ -95,15 +150,60 @@ bool DIBDecoder::loadStream(Common::SeekableReadStream &stream) {
 
 	_paletteColorCount = (_paletteColorCount == 0) ? 255: _paletteColorCount;
 
-	uint16 imageRawSize = stream.size() - 40;
+	if (!width || !height || width > 0xffff || height > 0xffff)
+		return false;
+
+	//Rows are stored bottom up, padded to 4 bytes
+	uint16 pitch = (width + 3) & ~3;
+
+	if (compression == 0 && bitsPerPixel == 8) {
+		//Read every row straight into place, no codec and no copy
+		_surface = _pool->acquire(width, height, pitch);
+
+		for (uint32 y = 0; y < height; y++)
+			stream.read(_surface->getBasePtr(0, height - 1 - y), pitch);
+
+		return true;
+	}
+
+	if (compression == 0 && (bitsPerPixel == 1 || bitsPerPixel == 4)) {
+		//Packed rows are never wider than the 8-bit ones, expand them in place
+		uint32 start = g_system->getMillis();
+		uint16 rowBytes = ((width * bitsPerPixel + 31) / 32) * 4;
+		const PixelExpander &expander = getIdentityExpander(bitsPerPixel);
+
+		_surface = _pool->acquire(width, height, pitch);
+
+		for (uint32 y = 0; y < height; y++) {
+			byte *row = (byte *)_surface->getBasePtr(0, height - 1 - y);
+
+			stream.read(row, rowBytes);
+			expander.expandRow(row, row, width);
+		}
+
+		debug(3, "DIB %dx%d, %d bpp expanded in %d ms", width, height, bitsPerPixel, g_system->getMillis() - start);
+
+		return true;
+	}
+
 	Common::SeekableSubReadStream subStream(&stream, 40, stream.size());
+	Image::Codec *codec = _codecs->getCodec(compression, width, height, bitsPerPixel);
+
+	if (!codec)
+		return false;
 
-	_codec = Image::createBitmapCodec(compression, width, height, bitsPerPixel);
+	const Graphics::Surface *frame = codec->decodeFrame(subStream);
 
-	if (!_codec)
+	if (!frame || frame->format.bytesPerPixel != 1) {
+		warning("DIB: unsupported %d bpp image, compression %x", bitsPerPixel, compression);
 		return false;
+	}
+
+	//The codec reuses its surface for the next decode
+	_surface = _pool->acquire(width, height, pitch);
 
-	_surface = _codec->decodeFrame(subStream);
+	for (uint32 y = 0; y < height; y++)
+		memcpy(_surface->getBasePtr(0, y), frame->getBasePtr(0, y), width);
 
 	return true;
 }
@@ -23,6 +23,7 @@
 #ifndef DIRECTOR_DIB_H
 #define DIRECTOR_DIB_H
 
+#include "common/array.h"
 #include "common/scummsys.h"
 #include "common/str.h"
 #include "image/image_decoder.h"
@@ -42,9 +43,33 @@ class Codec;
 
 namespace Director {
 
+class SurfacePool;
+
+// Codecs for DIB casts, kept across decodes. A codec reuses its output
+// surface for the next frame, so decoders copy it out right away.
+class DIBCodecCache {
+public:
+	DIBCodecCache();
+	~DIBCodecCache();
+
+	Image::Codec *getCodec(uint32 compression, uint32 width, uint32 height, uint16 bitsPerPixel);
+	void clear();
+
+private:
+	struct CodecEntry {
+		uint32 compression;
+		uint32 width;
+		uint32 height;
+		uint16 bitsPerPixel;
+		Image::Codec *codec;
+	};
+
+	Common::Array<CodecEntry> _codecs; // most recently used last
+};
+
 class DIBDecoder : public Image::ImageDecoder {
 public:
-	DIBDecoder();
+	DIBDecoder(SurfacePool *pool, DIBCodecCache *codecs);
 	virtual ~DIBDecoder();
 
 	// ImageDecoder API
@@ -56,8 +81,9 @@ public:
 	uint16 getPaletteColorCount() const { return _paletteColorCount; }
 
 private:
-	Image::Codec *_codec;
-	const Graphics::Surface *_surface;
+	SurfacePool *_pool;
+	DIBCodecCache *_codecs;
+	Graphics::Surface *_surface;
 	byte *_palette;
 	uint8 _paletteColorCount;
 };
@@ -35,14 +35,20 @@
 
 #include "engines/util.h"
 
+#include "graphics/palette.h"
 #include "graphics/surface.h"
 
 #include "director/director.h"
+#include "director/bitd.h"
+#include "director/blend.h"
 #include "director/dib.h"
+#include "director/expand.h"
+#include "director/profile.h"
 #include "director/resource.h"
 #include "director/score.h"
 #include "director/lingo/lingo.h"
 #include "director/sound.h"
+#include "director/surfacepool.h"
 
 namespace Director {
 
@@ -53,6 +59,39 @@ DirectorEngine::DirectorEngine(OSystem *syst, const DirectorGameDescription *gam
 
 	// Setup mixer
 	syncSoundSettings();
+
+	// Offscreen playback: no window, no tempo, optional per-frame dumps
+	// ("raw", "png" or "checksum")
+	ConfMan.registerDefault("director_headless", false);
+	ConfMan.registerDefault("director_frame_dump", "");
+
+	// Stage compositing in horizontal bands ("serial", "tiled" or "compare").
+	// The engine has no threads, so the bands are composited one after
+	// another; compare checks them against the serial result and times
+	// each band count up to director_tiles
+	ConfMan.registerDefault("director_compositor", "serial");
+	ConfMan.registerDefault("director_tiles", 8);
+
+	// Keep 1-bit cast bitmaps decoded and packed in memory
+	ConfMan.registerDefault("director_packed_bitmaps", true);
+
+	// Pace frames off when they were due, not when they ran
+	ConfMan.registerDefault("director_drift_compensation", true);
+
+	// Skip drawing frames that would make playback fall behind the tempo
+	ConfMan.registerDefault("director_frame_skip", false);
+
+	// Play as fast as possible in a window, ignoring tempo and waits,
+	// and present one frame in director_turbo_present
+	ConfMan.registerDefault("director_turbo", false);
+	ConfMan.registerDefault("director_turbo_present", 1);
+
+	// Log decoder, expander and blend throughput at startup
+	ConfMan.registerDefault("director_benchmark", false);
+
+	// Time the phases of each frame, the histograms are printed on exit
+	ConfMan.registerDefault("director_profile", false);
+
 	_sharedCasts = new Common::HashMap<int, Cast *>;
 	_sharedDIB = new Common::HashMap<int, Common::SeekableSubReadStreamEndian *>;
 	_sharedBMP = new Common::HashMap<int, Common::SeekableSubReadStreamEndian *>;
@@ -65,12 +104,21 @@ DirectorEngine::DirectorEngine(OSystem *syst, const DirectorGameDescription *gam
 	_sharedMMM = "SHARDCST.MMM";
 	_movies = new Common::HashMap<Common::String, Score *>;
 
+	memset(_screenPalette, 0, sizeof(_screenPalette));
+	memset(_screenPaletteSet, 0, sizeof(_screenPaletteSet));
+	_paletteVersion = 0;
+
 	const Common::FSNode gameDataDir(ConfMan.get("path"));
 	SearchMan.addSubDirectoryMatching(gameDataDir, "data");
 	SearchMan.addSubDirectoryMatching(gameDataDir, "install");
 }
 
 DirectorEngine::~DirectorEngine() {
+	if (_sharedCasts) {
+		for (Common::HashMap<int, Cast *>::iterator i = _sharedCasts->begin(); i != _sharedCasts->end(); ++i)
+			delete i->_value;
+	}
+
 	delete _sharedCasts;
 	delete _sharedSound;
 	delete _sharedBMP;
@@ -82,7 +130,19 @@ DirectorEngine::~DirectorEngine() {
 	delete _macBinary;
 	delete _soundManager;
 	delete _lingo;
+
+	//The score releases its decoded bitmaps into the pool
 	delete _currentScore;
+	delete _surfacePool;
+	delete _castExpanders;
+	delete _dibCodecs;
+
+	if (_profiler) {
+		_profiler->endFrame();
+		_profiler->dump();
+	}
+
+	delete _profiler;
 	delete _currentPalette;
 }
 
@@ -100,9 +160,25 @@ Common::Error DirectorEngine::run() {
 
 	_macBinary = nullptr;
 	_soundManager = nullptr;
+	_surfacePool = nullptr;
+	_castExpanders = nullptr;
+	_dibCodecs = nullptr;
+	_profiler = nullptr;
 
 	_lingo = new Lingo(this);
 	_soundManager = new DirectorSound();
+	_surfacePool = new SurfacePool();
+	_castExpanders = new CastExpanders();
+	_dibCodecs = new DIBCodecCache();
+
+	if (ConfMan.getBool("director_profile"))
+		_profiler = new PhaseProfiler();
+
+	if (ConfMan.getBool("director_benchmark")) {
+		benchmarkExpanders();
+		benchmarkDecoders();
+		benchmarkBlend();
+	}
 
 	if (getGameID() == GID_TEST) {
 		_mainArchive = nullptr;
@@ -305,6 +381,32 @@ Common::String DirectorEngine::readPascalString(Common::SeekableReadStream &stre
 void DirectorEngine::setPalette(byte *palette, uint16 count) {
 	_currentPalette = palette;
 	_currentPaletteLength = count;
+	_paletteVersion++;
+
+	if (_castExpanders)
+		_castExpanders->setPalette(palette, count);
+}
+
+bool DirectorEngine::uploadPalette(const byte *palette, uint16 first, uint16 count) {
+	//Trim entries that are already on screen from both ends, so movies
+	//sharing a palette and effects touching a few colors upload little
+	while (count && _screenPaletteSet[first] && !memcmp(palette + first * 3, _screenPalette + first * 3, 3)) {
+		first++;
+		count--;
+	}
+
+	while (count && _screenPaletteSet[first + count - 1] && !memcmp(palette + (first + count - 1) * 3, _screenPalette + (first + count - 1) * 3, 3))
+		count--;
+
+	if (!count)
+		return false;
+
+	memcpy(_screenPalette + first * 3, palette + first * 3, count * 3);
+	memset(_screenPaletteSet + first, 1, count);
+
+	g_system->getPaletteManager()->setPalette(palette + first * 3, first, count);
+
+	return true;
 }
 
 void DirectorEngine::loadSharedCastsFrom(Common::String filename) {
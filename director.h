@@ -47,6 +47,10 @@ class Archive;
 struct DirectorGameDescription;
 class Lingo;
 class Score;
+class SurfacePool;
+class CastExpanders;
+class DIBCodecCache;
+class PhaseProfiler;
 struct Cast;
 
 class DirectorEngine : public ::Engine {
@@ -65,10 +69,16 @@ public:
 	Archive *getMainArchive() const { return _mainArchive; }
 	Lingo *getLingo() const { return _lingo; }
 	Score *getCurrentScore() const { return _currentScore; }
+	SurfacePool *getSurfacePool() const { return _surfacePool; }
+	CastExpanders *getCastExpanders() const { return _castExpanders; }
+	DIBCodecCache *getDIBCodecs() const { return _dibCodecs; }
+	PhaseProfiler *getProfiler() const { return _profiler; }
 	void setPalette(byte *palette, uint16 count);
+	bool uploadPalette(const byte *palette, uint16 first, uint16 count);
 	bool hasFeature(EngineFeature f) const;
 	const byte *getPalette() const { return _currentPalette; }
 	uint16 getPaletteColorCount() const { return _currentPaletteLength; }
+	uint32 getPaletteVersion() const { return _paletteVersion; }
 	void loadSharedCastsFrom(Common::String filename);
 	Common::HashMap<int, Common::SeekableSubReadStreamEndian *> *getSharedDIB() const { return _sharedDIB; }
 	Common::HashMap<int, Common::SeekableSubReadStreamEndian *> *getSharedBMP() const { return _sharedBMP; }
@@ -107,8 +117,15 @@ private:
 	Archive *_mainArchive;
 	Common::MacResManager *_macBinary;
 	DirectorSound *_soundManager;
+	SurfacePool *_surfacePool;
+	CastExpanders *_castExpanders; // cast depths remapped to the stage palette
+	DIBCodecCache *_dibCodecs;
+	PhaseProfiler *_profiler; // only with director_profile set
 	byte *_currentPalette;
 	uint16 _currentPaletteLength;
+	uint32 _paletteVersion; // bumped by setPalette()
+	byte _screenPalette[768]; // last colors sent to the backend
+	bool _screenPaletteSet[256];
 	Lingo *_lingo;
 };
 
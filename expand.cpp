@@ -0,0 +1,216 @@
+/* ScummVM - Graphic Adventure Engine
+ *
+ * ScummVM is the legal property of its developers, whose names
+ * are too numerous to list here. Please refer to the COPYRIGHT
+ * file distributed with this source distribution.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+ *
+ */
+
+#include "common/debug.h"
+#include "common/system.h"
+#include "common/textconsole.h"
+#include "common/util.h"
+
+#include "director/expand.h"
+
+namespace Director {
+
+void PixelExpander::init(uint8 bpp, const byte *remap) {
+	bitsPerPixel = bpp;
+	pixelsPerByte = 8 / bpp;
+
+	byte mask = (1 << bpp) - 1;
+
+	for (int value = 0; value < 256; value++)
+		for (int i = 0; i < pixelsPerByte; i++)
+			table[value][i] = remap[(value >> (8 - bpp * (i + 1))) & mask];
+}
+
+void PixelExpander::expandRow(byte *dst, const byte *src, uint16 width) const {
+	uint16 full = width / pixelsPerByte;
+	uint16 rest = width % pixelsPerByte;
+
+	//Back to front, so a row can be expanded over its own packed data
+	if (rest)
+		memcpy(dst + full * pixelsPerByte, table[src[full]], rest);
+
+	switch (pixelsPerByte) {
+	case 8:
+		for (int i = full - 1; i >= 0; i--)
+			memcpy(dst + i * 8, table[src[i]], 8);
+		break;
+	case 4:
+		for (int i = full - 1; i >= 0; i--)
+			memcpy(dst + i * 4, table[src[i]], 4);
+		break;
+	case 2:
+		for (int i = full - 1; i >= 0; i--)
+			memcpy(dst + i * 2, table[src[i]], 2);
+		break;
+	default:
+		for (int i = full - 1; i >= 0; i--)
+			dst[i] = table[src[i]][0];
+		break;
+	}
+}
+
+static int getExpanderIndex(uint8 bitsPerPixel) {
+	switch (bitsPerPixel) {
+	case 1: return 0;
+	case 2: return 1;
+	case 4: return 2;
+	case 8: return 3;
+	default:
+		error("getExpanderIndex: unsupported depth %d", bitsPerPixel);
+	}
+}
+
+const PixelExpander &getIdentityExpander(uint8 bitsPerPixel) {
+	static PixelExpander expanders[4];
+	static bool initialized[4] = { false, false, false, false };
+
+	int index = getExpanderIndex(bitsPerPixel);
+
+	if (!initialized[index]) {
+		byte remap[256];
+
+		for (int i = 0; i < 256; i++)
+			remap[i] = i;
+
+		expanders[index].init(bitsPerPixel, remap);
+		initialized[index] = true;
+	}
+
+	return expanders[index];
+}
+
+//The standard Mac 'clut' resources 2 and 4, white first
+static const byte macPalette4[4 * 3] = {
+	0xff, 0xff, 0xff,  0xac, 0xac, 0xac,  0x55, 0x55, 0x55,  0x00, 0x00, 0x00
+};
+
+static const byte macPalette16[16 * 3] = {
+	0xff, 0xff, 0xff,  0xfc, 0xf3, 0x05,  0xff, 0x64, 0x02,  0xdd, 0x08, 0x06,
+	0xf2, 0x08, 0x84,  0x46, 0x00, 0xa5,  0x00, 0x00, 0xd4,  0x02, 0xab, 0xea,
+	0x1f, 0xb7, 0x14,  0x00, 0x64, 0x11,  0x56, 0x2c, 0x05,  0x90, 0x71, 0x3a,
+	0xc0, 0xc0, 0xc0,  0x80, 0x80, 0x80,  0x40, 0x40, 0x40,  0x00, 0x00, 0x00
+};
+
+CastExpanders::CastExpanders() {
+	memset(_built, 0, sizeof(_built));
+	memset(_palette, 0, sizeof(_palette));
+	_colorCount = 0;
+}
+
+void CastExpanders::setPalette(const byte *palette, uint16 colorCount) {
+	memset(_built, 0, sizeof(_built));
+	_colorCount = MIN<uint16>(colorCount, 256);
+
+	if (palette)
+		memcpy(_palette, palette, _colorCount * 3);
+	else
+		_colorCount = 0;
+}
+
+byte CastExpanders::findNearest(byte r, byte g, byte b) const {
+	uint32 best = 0xffffffff;
+	byte index = 0;
+
+	for (uint16 i = 0; i < _colorCount; i++) {
+		int dr = _palette[i * 3 + 0] - r;
+		int dg = _palette[i * 3 + 1] - g;
+		int db = _palette[i * 3 + 2] - b;
+		uint32 distance = dr * dr + dg * dg + db * db;
+
+		if (distance < best) {
+			best = distance;
+			index = i;
+
+			if (!distance)
+				break;
+		}
+	}
+
+	return index;
+}
+
+const PixelExpander &CastExpanders::get(uint8 bitsPerPixel) {
+	int index = getExpanderIndex(bitsPerPixel);
+
+	if (!_built[index]) {
+		byte remap[256];
+
+		for (int i = 0; i < 256; i++)
+			remap[i] = i;
+
+		//Without a palette yet, the values are kept
+		if (bitsPerPixel == 1) {
+			remap[0] = (_colorCount ? _colorCount : 256) - 1;
+			remap[1] = 0;
+		} else if (bitsPerPixel < 8 && _colorCount) {
+			const byte *clut = bitsPerPixel == 2 ? macPalette4 : macPalette16;
+
+			for (int i = 0; i < (1 << bitsPerPixel); i++)
+				remap[i] = findNearest(clut[i * 3 + 0], clut[i * 3 + 1], clut[i * 3 + 2]);
+		}
+
+		_expanders[index].init(bitsPerPixel, remap);
+		_built[index] = true;
+	}
+
+	return _expanders[index];
+}
+
+void benchmarkExpanders() {
+	//A 640x480 stage worth of pixels, expanded a few times per depth
+	const uint16 width = 640;
+	const uint16 height = 480;
+	const int rounds = 20;
+
+	byte *src = new byte[width];
+	byte *dst = new byte[width];
+
+	for (int i = 0; i < width; i++)
+		src[i] = (i * 37) ^ (i >> 3);
+
+	CastExpanders expanders;
+	byte palette[256 * 3];
+
+	//A gray ramp, black first like the stage palettes
+	for (int i = 0; i < 256; i++)
+		palette[i * 3 + 0] = palette[i * 3 + 1] = palette[i * 3 + 2] = i;
+
+	expanders.setPalette(palette, 256);
+
+	for (uint8 bpp = 1; bpp <= 8; bpp *= 2) {
+		const PixelExpander &expander = expanders.get(bpp);
+		uint32 start = g_system->getMillis();
+
+		for (int r = 0; r < rounds; r++)
+			for (int y = 0; y < height; y++)
+				expander.expandRow(dst, src, width);
+
+		uint32 elapsed = MAX<uint32>(g_system->getMillis() - start, 1);
+
+		debug("Expanding %d bpp: %d pixels per ms", bpp, (uint32)width * height * rounds / elapsed);
+	}
+
+	delete[] src;
+	delete[] dst;
+}
+
+} // End of namespace Director
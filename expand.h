@@ -0,0 +1,72 @@
+/* ScummVM - Graphic Adventure Engine
+ *
+ * ScummVM is the legal property of its developers, whose names
+ * are too numerous to list here. Please refer to the COPYRIGHT
+ * file distributed with this source distribution.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+ *
+ */
+
+#ifndef DIRECTOR_EXPAND_H
+#define DIRECTOR_EXPAND_H
+
+#include "common/scummsys.h"
+
+namespace Director {
+
+// Unpacks rows of 1, 2, 4 or 8 bit pixels to one byte per pixel, mapping
+// every value through a remap table on the way. Each packed byte is
+// looked up once and stored as a whole run of output pixels.
+struct PixelExpander {
+	void init(uint8 bitsPerPixel, const byte *remap);
+	void expandRow(byte *dst, const byte *src, uint16 width) const;
+
+	uint8 bitsPerPixel;
+	uint8 pixelsPerByte;
+	byte table[256][8];
+};
+
+// Keeps every value, for images that carry their own palette
+const PixelExpander &getIdentityExpander(uint8 bitsPerPixel);
+
+// Expanders for cast bitmaps, remapped to the stage palette. The engine
+// keeps palettes with black at index 0 and white at the last entry, so
+// set bits of 1-bit casts become 0 and clear bits colorCount - 1. 2 and
+// 4-bit casts index the Mac system 4 and 16 color tables, each entry is
+// mapped to the nearest stage color.
+class CastExpanders {
+public:
+	CastExpanders();
+
+	// Drops the remaps built for the previous palette
+	void setPalette(const byte *palette, uint16 colorCount);
+	const PixelExpander &get(uint8 bitsPerPixel);
+
+private:
+	byte findNearest(byte r, byte g, byte b) const;
+
+	PixelExpander _expanders[4];
+	bool _built[4];
+	byte _palette[768];
+	uint16 _colorCount;
+};
+
+// Logs the throughput of every depth, remapped to a gray ramp
+void benchmarkExpanders();
+
+} // End of namespace Director
+
+#endif
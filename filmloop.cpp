@@ -0,0 +1,163 @@
+/* ScummVM - Graphic Adventure Engine
+ *
+ * ScummVM is the legal property of its developers, whose names
+ * are too numerous to list here. Please refer to the COPYRIGHT
+ * file distributed with this source distribution.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+ *
+ */
+
+#include "common/debug.h"
+#include "common/system.h"
+#include "common/textconsole.h"
+
+#include "director/director.h"
+#include "director/score.h"
+
+namespace Director {
+
+void Score::loadFilmLoop(FilmLoopCast *loop, Common::SeekableSubReadStreamEndian &stream) {
+	//Same channel layout as the movie score
+	readFrames(stream, loop->frames);
+
+	for (uint16 i = 0; i < loop->frames.size(); i++) {
+		for (uint16 j = 0; j < loop->frames[i]->_sprites.size(); j++) {
+			byte castId = loop->frames[i]->_sprites[j]->_castId;
+
+			if (_casts.contains(castId))
+				loop->frames[i]->_sprites[j]->_cast = _casts.find(castId)->_value;
+		}
+	}
+
+	debug(2, "Film loop with %d frames, %d x %d", loop->frames.size(), loop->initialRect.width(), loop->initialRect.height());
+}
+
+const Graphics::Surface *Score::getFilmLoopFrame(FilmLoopCast *loop, uint16 channel) {
+	//A loop can't show up inside itself
+	if (loop->building)
+		return nullptr;
+
+	if (!loop->cacheBuilt)
+		buildFilmLoopCache(loop);
+
+	if (loop->cache.empty())
+		return nullptr;
+
+	//A channel advances the loop once per score frame, and starts it over
+	//when the loop wasn't in it on the previous one
+	uint16 &frame = loop->currentFrame[channel];
+	uint32 &shown = loop->lastShown[channel];
+
+	if (shown == _renderedFrames)
+		frame = (frame + 1) % loop->cache.size();
+	else if (shown != _renderedFrames + 1)
+		frame = 0;
+
+	shown = _renderedFrames + 1;
+
+	return loop->cache[frame];
+}
+
+void Score::buildFilmLoopCache(FilmLoopCast *loop) {
+	loop->cacheBuilt = true;
+
+	//The loop sprites keep the stage positions they were recorded at
+	Common::Rect bounds = loop->initialRect;
+	bounds.clip(Common::Rect(_surface->w, _surface->h));
+
+	if (bounds.isEmpty() || loop->frames.empty()) {
+		warning("Film loop is empty or off the stage");
+		return;
+	}
+
+	//Sprites are placed from the whole loop, not the part that was kept
+	loop->cacheOffset = Common::Point(bounds.left - loop->initialRect.left, bounds.top - loop->initialRect.top);
+	loop->building = true;
+	uint32 start = g_system->getMillis();
+
+	//Each frame is composited over two backgrounds, pixels no sprite
+	//covers are the only ones that come out different
+	Graphics::ManagedSurface dark, light;
+	dark.create(_surface->w, _surface->h);
+	light.create(_surface->w, _surface->h);
+
+	Common::Array<Graphics::Surface *> masks;
+	bool used[256];
+	memset(used, 0, sizeof(used));
+
+	for (uint i = 0; i < loop->frames.size(); i++) {
+		dark.fillRect(bounds, 0);
+		loop->frames[i]->composite(dark, bounds);
+		light.fillRect(bounds, 0xff);
+		loop->frames[i]->composite(light, bounds);
+
+		Graphics::Surface *frame = new Graphics::Surface;
+		frame->create(bounds.width(), bounds.height(), Graphics::PixelFormat::createFormatCLUT8());
+		Graphics::Surface *mask = new Graphics::Surface;
+		mask->create(bounds.width(), bounds.height(), Graphics::PixelFormat::createFormatCLUT8());
+
+		for (int y = 0; y < bounds.height(); y++) {
+			const byte *d = (const byte *)dark.getBasePtr(bounds.left, bounds.top + y);
+			const byte *l = (const byte *)light.getBasePtr(bounds.left, bounds.top + y);
+			byte *dst = (byte *)frame->getBasePtr(0, y);
+			byte *m = (byte *)mask->getBasePtr(0, y);
+
+			for (int x = 0; x < bounds.width(); x++) {
+				m[x] = (d[x] == 0 && l[x] == 0xff);
+				dst[x] = d[x];
+
+				if (!m[x])
+					used[d[x]] = true;
+			}
+		}
+
+		loop->cache.push_back(frame);
+		masks.push_back(mask);
+	}
+
+	//Any color the loop never draws will do as the transparent one
+	loop->keyColor = 0xff;
+
+	for (int c = 255; c >= 0; c--) {
+		if (!used[c]) {
+			loop->keyColor = c;
+			break;
+		}
+	}
+
+	if (used[loop->keyColor])
+		warning("Film loop uses every color, color %d will show through", loop->keyColor);
+
+	for (uint i = 0; i < loop->cache.size(); i++) {
+		for (int y = 0; y < bounds.height(); y++) {
+			byte *dst = (byte *)loop->cache[i]->getBasePtr(0, y);
+			const byte *m = (const byte *)masks[i]->getBasePtr(0, y);
+
+			for (int x = 0; x < bounds.width(); x++)
+				if (m[x])
+					dst[x] = loop->keyColor;
+		}
+
+		masks[i]->free();
+		delete masks[i];
+	}
+
+	loop->building = false;
+
+	debug(2, "Film loop of %d frames composited in %d ms", loop->cache.size(), g_system->getMillis() - start);
+}
+
+} // End of namespace Director
@@ -0,0 +1,148 @@
+/* ScummVM - Graphic Adventure Engine
+ *
+ * ScummVM is the legal property of its developers, whose names
+ * are too numerous to list here. Please refer to the COPYRIGHT
+ * file distributed with this source distribution.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+ *
+ */
+
+#include "common/util.h"
+#include "graphics/pixelformat.h"
+
+#include "director/glyphs.h"
+
+namespace Director {
+
+// Layouts are cheap to rebuild, so just start over once that many are stored
+#define MAX_CACHED_LAYOUTS 256
+
+GlyphAtlas::GlyphAtlas(const Graphics::Font *font) {
+	_font = font;
+	_height = font->getFontHeight();
+
+	uint16 atlasWidth = 0;
+	int top = 0;
+	int bottom = _height;
+
+	for (uint16 chr = 0; chr < 256; chr++) {
+		_glyphX[chr] = atlasWidth;
+		_glyphWidth[chr] = MAX(font->getCharWidth(chr), 0);
+		_glyphBox[chr] = font->getBoundingBox(chr);
+
+		if (_glyphBox[chr].isEmpty()) {
+			_glyphBox[chr] = Common::Rect();
+			continue;
+		}
+
+		atlasWidth += _glyphBox[chr].width();
+		top = MIN<int>(top, _glyphBox[chr].top);
+		bottom = MAX<int>(bottom, _glyphBox[chr].bottom);
+	}
+
+	_atlasTop = top;
+	_atlas.create(MAX<uint16>(atlasWidth, 1), MAX(bottom - top, 1), Graphics::PixelFormat::createFormatCLUT8());
+	memset(_atlas.getPixels(), 0, _atlas.pitch * _atlas.h);
+
+	//Each glyph's box starts at its slot, whatever its offset from the pen
+	for (uint16 chr = 0; chr < 256; chr++) {
+		if (!_glyphBox[chr].isEmpty())
+			font->drawChar(&_atlas, chr, _glyphX[chr] - _glyphBox[chr].left, -top, 1);
+	}
+}
+
+GlyphAtlas::~GlyphAtlas() {
+	_atlas.free();
+
+	for (Common::HashMap<Common::String, TextLayout *>::iterator i = _layouts.begin(); i != _layouts.end(); ++i)
+		delete i->_value;
+}
+
+const TextLayout *GlyphAtlas::getLayout(const Common::String &text, int maxWidth) {
+	Common::String key = Common::String::format("%d:", maxWidth) + text;
+
+	if (_layouts.contains(key))
+		return _layouts[key];
+
+	if (_layouts.size() >= MAX_CACHED_LAYOUTS) {
+		for (Common::HashMap<Common::String, TextLayout *>::iterator i = _layouts.begin(); i != _layouts.end(); ++i)
+			delete i->_value;
+
+		_layouts.clear();
+	}
+
+	TextLayout *layout = new TextLayout;
+	_font->wordWrapText(text, maxWidth, layout->lines);
+
+	layout->offsets.resize(layout->lines.size());
+
+	for (uint i = 0; i < layout->lines.size(); i++) {
+		const Common::String &line = layout->lines[i];
+		Common::Array<uint16> &offsets = layout->offsets[i];
+		int x = 0;
+		byte last = 0;
+
+		offsets.resize(line.size());
+
+		for (uint j = 0; j < line.size(); j++) {
+			byte chr = line[j];
+
+			x += _font->getKerningOffset(last, chr);
+			offsets[j] = MAX(x, 0);
+			x += _glyphWidth[chr];
+			last = chr;
+		}
+	}
+
+	_layouts[key] = layout;
+
+	return layout;
+}
+
+void GlyphAtlas::drawLine(Graphics::Surface *dst, const Common::String &line, const Common::Array<uint16> &offsets, int x, int y, byte color) const {
+	for (int row = 0; row < _atlas.h; row++) {
+		int dy = y + _atlasTop + row;
+
+		if (dy < 0 || dy >= dst->h)
+			continue;
+
+		byte *dstRow = (byte *)dst->getBasePtr(0, dy);
+		const byte *maskRow = (const byte *)_atlas.getBasePtr(0, row);
+
+		for (uint i = 0; i < line.size(); i++) {
+			byte chr = line[i];
+			const byte *mask = maskRow + _glyphX[chr];
+			int gx = x + offsets[i] + _glyphBox[chr].left;
+			int from = MAX(0, -gx);
+			int to = MIN<int>(_glyphBox[chr].width(), dst->w - gx);
+
+			for (int j = from; j < to; j++)
+				if (mask[j])
+					dstRow[gx + j] = color;
+		}
+	}
+}
+
+Common::Rect GlyphAtlas::drawText(Graphics::Surface *dst, const Common::String &text, int x, int y, int maxWidth, byte color) {
+	const TextLayout *layout = getLayout(text, maxWidth);
+
+	for (uint i = 0; i < layout->lines.size(); i++)
+		drawLine(dst, layout->lines[i], layout->offsets[i], x, y + i * _height, color);
+
+	return Common::Rect(x, y, x + maxWidth, y + layout->lines.size() * _height);
+}
+
+} // End of namespace Director
@@ -0,0 +1,69 @@
+/* ScummVM - Graphic Adventure Engine
+ *
+ * ScummVM is the legal property of its developers, whose names
+ * are too numerous to list here. Please refer to the COPYRIGHT
+ * file distributed with this source distribution.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+ *
+ */
+
+#ifndef DIRECTOR_GLYPHS_H
+#define DIRECTOR_GLYPHS_H
+
+#include "common/array.h"
+#include "common/hashmap.h"
+#include "common/hash-str.h"
+#include "common/rect.h"
+#include "common/str.h"
+#include "graphics/font.h"
+#include "graphics/surface.h"
+
+namespace Director {
+
+struct TextLayout {
+	Common::Array<Common::String> lines;
+	Common::Array<Common::Array<uint16> > offsets; // x of every glyph, per line
+};
+
+// All 256 glyphs of a font expanded to 8-bit masks, drawn a line at a time.
+// Slots are sized from the glyph boxes, which can overhang the advance or
+// the line, so batched text matches what drawString() gives.
+class GlyphAtlas {
+public:
+	GlyphAtlas(const Graphics::Font *font);
+	~GlyphAtlas();
+
+	const Graphics::Font *getFont() const { return _font; }
+	int getFontHeight() const { return _height; }
+
+	const TextLayout *getLayout(const Common::String &text, int maxWidth);
+	void drawLine(Graphics::Surface *dst, const Common::String &line, const Common::Array<uint16> &offsets, int x, int y, byte color) const;
+	Common::Rect drawText(Graphics::Surface *dst, const Common::String &text, int x, int y, int maxWidth, byte color);
+
+private:
+	const Graphics::Font *_font;
+	int _height;
+	Graphics::Surface _atlas;
+	int _atlasTop; // line y of the atlas' first row, negative above the ascent
+	uint16 _glyphX[256];
+	uint16 _glyphWidth[256]; // advance
+	Common::Rect _glyphBox[256]; // drawn pixels, relative to the pen
+	Common::HashMap<Common::String, TextLayout *> _layouts;
+};
+
+} // End of namespace Director
+
+#endif
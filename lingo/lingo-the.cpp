@@ -178,6 +178,9 @@ void Lingo::setTheEntity(int entity, Datum &id, int field, Datum &d) {
 	case kTheSprite:
 		setTheSprite(id, field, d);
 		break;
+	case kTheCast:
+		setTheCast(id, field, d);
+		break;
 	case kThePerFrameHook:
 		warning("STUB: setting the perframehook");
 		break;
@@ -432,14 +435,17 @@ void Lingo::setTheCast(Datum &id1, int field, Datum &d) {
 	case kTheCastType:
 		cast->type = static_cast<CastType>(d.u.i);
 		cast->modified = 1;
+		cast->version++;
 		break;
 	case kTheWidth:
 		cast->initialRect.setWidth(d.u.i);
 		cast->modified = 1;
+		cast->version++;
 		break;
 	case kTheHeight:
 		cast->initialRect.setHeight(d.u.i);
 		cast->modified = 1;
+		cast->version++;
 		break;
 	case kTheBackColor:
 		{
@@ -449,6 +455,7 @@ void Lingo::setTheCast(Datum &id1, int field, Datum &d) {
 			ShapeCast *shape = static_cast<ShapeCast *>(_vm->_currentScore->_casts[id]);
 			shape->bgCol = d.u.i;
 			shape->modified = 1;
+			shape->version++;
 		}
 		break;
 	case kTheForeColor:
@@ -460,6 +467,18 @@ void Lingo::setTheCast(Datum &id1, int field, Datum &d) {
 			ShapeCast *shape = static_cast<ShapeCast *>(_vm->_currentScore->_casts[id]);
 			shape->fgCol = d.u.i;
 			shape->modified = 1;
+			shape->version++;
+		}
+		break;
+	case kTheText:
+		{
+			if (cast->type != kCastText && cast->type != kCastButton) {
+				warning("Field %d of cast %d not found", field, id);
+				return;
+			}
+			TextCast *text = static_cast<TextCast *>(_vm->_currentScore->_casts[id]);
+			text->setText(*d.toString());
+			text->modified = 1;
 		}
 		break;
 	default:
@@ -1,13 +1,25 @@
 MODULE := engines/director
 
 MODULE_OBJS = \
+	bitd.o \
+	blend.o \
 	detection.o \
 	dib.o \
 	director.o \
+	expand.o \
+	filmloop.o \
+	glyphs.o \
 	movie.o \
+	packed.o \
+	palette.o \
+	profile.o \
 	resource.o \
+	schedule.o \
 	score.o \
+	shapes.o \
 	sound.o \
+	surfacepool.o \
+	transitions.o \
 	lingo/lingo-gr.o \
 	lingo/lingo.o \
 	lingo/lingo-builtins.o \
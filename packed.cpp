@@ -0,0 +1,141 @@
+/* ScummVM - Graphic Adventure Engine
+ *
+ * ScummVM is the legal property of its developers, whose names
+ * are too numerous to list here. Please refer to the COPYRIGHT
+ * file distributed with this source distribution.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+ *
+ */
+
+#include "graphics/surface.h"
+
+#include "director/director.h"
+#include "director/expand.h"
+#include "director/score.h"
+#include "director/surfacepool.h"
+
+namespace Director {
+
+PackedBitmap::PackedBitmap(const Graphics::Surface &surface) {
+	width = surface.w;
+	height = surface.h;
+	rowBytes = (width + 7) / 8;
+	bits = new byte[rowBytes * height];
+	matte = nullptr;
+
+	memset(bits, 0, rowBytes * height);
+
+	for (int y = 0; y < height; y++) {
+		const byte *src = (const byte *)surface.getBasePtr(0, y);
+		byte *dst = bits + y * rowBytes;
+
+		//Only black pixels set a bit, as in the cast data
+		for (int x = 0; x < width; x++)
+			if (src[x] == 0)
+				dst[x >> 3] |= 0x80 >> (x & 7);
+	}
+}
+
+PackedBitmap::~PackedBitmap() {
+	delete[] bits;
+	delete[] matte;
+}
+
+Graphics::Surface *Frame::unpackBitmap(const PackedBitmap &packed) {
+	Graphics::Surface *surface = _vm->getSurfacePool()->acquire(packed.width, packed.height, (packed.width + 1) & ~1);
+	const PixelExpander &expander = _vm->getCastExpanders()->get(1);
+
+	for (int y = 0; y < packed.height; y++)
+		expander.expandRow((byte *)surface->getBasePtr(0, y), packed.bits + y * packed.rowBytes, packed.width);
+
+	return surface;
+}
+
+void Frame::buildPackedMatte(PackedBitmap &packed) {
+	Graphics::Surface *surface = unpackBitmap(packed);
+	Graphics::Surface *mask = createMatteMask(*surface);
+
+	packed.matte = new byte[packed.rowBytes * packed.height];
+	memset(packed.matte, 0, packed.rowBytes * packed.height);
+
+	for (int y = 0; y < packed.height; y++) {
+		const byte *src = (const byte *)mask->getBasePtr(0, y);
+		byte *dst = packed.matte + y * packed.rowBytes;
+
+		for (int x = 0; x < packed.width; x++)
+			if (src[x])
+				dst[x >> 3] |= 0x80 >> (x & 7);
+	}
+
+	mask->free();
+	delete mask;
+	_vm->getSurfacePool()->release(surface);
+}
+
+void Frame::drawPackedSprite(Graphics::ManagedSurface &target, PackedBitmap &packed, const Common::Rect &srcRect, const Common::Point &dstPos, InkType ink) {
+	//The colors the bitmap would have once unpacked, so both paths match
+	uint8 skipColor = _vm->getPaletteColorCount() - 1;
+	const byte colors[2] = { skipColor, 0 };
+	bool draw[2] = { true, true };
+
+	if (ink == kInkTypeBackgndTrans) {
+		draw[0] = colors[0] != skipColor;
+		draw[1] = colors[1] != skipColor;
+	}
+
+	if (ink == kInkTypeMatte && !packed.matte)
+		buildPackedMatte(packed);
+
+	for (int yy = 0; yy < srcRect.height(); yy++) {
+		uint32 offset = (srcRect.top + yy) * packed.rowBytes + (srcRect.left >> 3);
+		const byte *src = packed.bits + offset;
+		byte *dst = (byte *)target.getBasePtr(dstPos.x, dstPos.y + yy);
+		byte bit = 0x80 >> (srcRect.left & 7);
+
+		if (ink == kInkTypeMatte) {
+			const byte *mask = packed.matte + offset;
+
+			for (int xx = 0; xx < srcRect.width(); xx++) {
+				if (!(*mask & bit))
+					dst[xx] = colors[(*src & bit) != 0];
+
+				bit >>= 1;
+
+				if (!bit) {
+					bit = 0x80;
+					src++;
+					mask++;
+				}
+			}
+		} else {
+			for (int xx = 0; xx < srcRect.width(); xx++) {
+				int value = (*src & bit) != 0;
+
+				if (draw[value])
+					dst[xx] = colors[value];
+
+				bit >>= 1;
+
+				if (!bit) {
+					bit = 0x80;
+					src++;
+				}
+			}
+		}
+	}
+}
+
+} // End of namespace Director
@@ -0,0 +1,139 @@
+/* ScummVM - Graphic Adventure Engine
+ *
+ * ScummVM is the legal property of its developers, whose names
+ * are too numerous to list here. Please refer to the COPYRIGHT
+ * file distributed with this source distribution.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+ *
+ */
+
+#include "common/debug.h"
+#include "common/system.h"
+#include "common/util.h"
+
+#include "director/director.h"
+#include "director/score.h"
+
+namespace Director {
+
+// Levels per fade direction, and the rate used when the channel has no speed
+enum {
+	kPaletteFadeSteps = 30,
+	kPaletteDefaultSpeed = 30
+};
+
+void Score::startPaletteEffect(const PaletteInfo &info) {
+	//The channel is copied along its whole span, only its first frame starts anything
+	bool changed = memcmp(&info, &_lastPaletteInfo, sizeof(PaletteInfo)) != 0;
+	_lastPaletteInfo = info;
+
+	if (!changed)
+		return;
+
+	//Cycling lasts as long as the channel, a fade always runs to the end
+	if (_paletteEffect.active && !_paletteEffect.steps)
+		_paletteEffect.active = false;
+
+	if (!info.paletteId)
+		return;
+
+	uint16 colorCount = _vm->getPaletteColorCount();
+
+	if (info.flags & kPaletteCycle) {
+		if (info.firstColor >= info.lastColor || info.lastColor >= colorCount) {
+			warning("Bad palette cycle range %d-%d", info.firstColor, info.lastColor);
+			return;
+		}
+
+		_paletteEffect.steps = 0;
+	} else if ((info.flags & kPaletteFadeMask) == kPaletteFadeToBlack || (info.flags & kPaletteFadeMask) == kPaletteFadeToWhite) {
+		//Out to the fade color and back in to the movie palette
+		_paletteEffect.steps = 2 * kPaletteFadeSteps;
+	} else {
+		//TODO: switching to palette cast members
+		debug(2, "Unhandled palette channel %d, flags 0x%02x", info.paletteId, info.flags);
+		return;
+	}
+
+	memcpy(_effectPalette, _vm->getPalette(), colorCount * 3);
+
+	_paletteEffect.info = info;
+	_paletteEffect.interval = 1000 / (info.speed ? info.speed : kPaletteDefaultSpeed);
+	_paletteEffect.nextStep = g_system->getMillis() + _paletteEffect.interval;
+	_paletteEffect.step = 0;
+	_paletteEffect.direction = 1;
+	_paletteEffect.active = true;
+}
+
+void Score::stepPaletteEffect() {
+	if (!_paletteEffect.active)
+		return;
+
+	uint32 now = g_system->getMillis();
+
+	if (now < _paletteEffect.nextStep)
+		return;
+
+	//Catch up on the steps missed by a slow frame, but upload only once
+	uint32 elapsed = (now - _paletteEffect.nextStep) / _paletteEffect.interval + 1;
+	_paletteEffect.nextStep += elapsed * _paletteEffect.interval;
+
+	const PaletteInfo &info = _paletteEffect.info;
+	const byte *base = _vm->getPalette();
+
+	if (!_paletteEffect.steps) {
+		uint16 first = info.firstColor;
+		uint16 length = info.lastColor - info.firstColor + 1;
+
+		for (uint32 i = 0; i < elapsed; i++) {
+			//Auto reverse bounces between the two ends of the range
+			if (info.flags & kPaletteAutoReverse) {
+				if (_paletteEffect.step + _paletteEffect.direction >= length || _paletteEffect.step + _paletteEffect.direction < 0)
+					_paletteEffect.direction = -_paletteEffect.direction;
+
+				_paletteEffect.step += _paletteEffect.direction;
+			} else {
+				_paletteEffect.step = (_paletteEffect.step + 1) % length;
+			}
+		}
+
+		for (uint16 i = 0; i < length; i++)
+			memcpy(_effectPalette + (first + i) * 3, base + (first + (i + _paletteEffect.step) % length) * 3, 3);
+
+		if (_vm->uploadPalette(_effectPalette, first, length))
+			_screenChanged = true;
+
+		return;
+	}
+
+	_paletteEffect.step = MIN<uint32>(_paletteEffect.step + elapsed, _paletteEffect.steps);
+
+	//Distance from the movie palette, 0 at both ends of the fade
+	int level = _paletteEffect.step <= kPaletteFadeSteps ? _paletteEffect.step : _paletteEffect.steps - _paletteEffect.step;
+	int target = (info.flags & kPaletteFadeMask) == kPaletteFadeToWhite ? 0xff : 0;
+	uint16 colorCount = _vm->getPaletteColorCount();
+
+	for (uint i = 0; i < colorCount * 3u; i++)
+		_effectPalette[i] = base[i] + (target - base[i]) * level / kPaletteFadeSteps;
+
+	if (_vm->uploadPalette(_effectPalette, 0, colorCount))
+		_screenChanged = true;
+
+	if (_paletteEffect.step == _paletteEffect.steps)
+		_paletteEffect.active = false;
+}
+
+} // End of namespace Director
@@ -0,0 +1,150 @@
+/* ScummVM - Graphic Adventure Engine
+ *
+ * ScummVM is the legal property of its developers, whose names
+ * are too numerous to list here. Please refer to the COPYRIGHT
+ * file distributed with this source distribution.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+ *
+ */
+
+#include "common/debug.h"
+#include "common/str.h"
+#include "common/util.h"
+
+#include "director/profile.h"
+
+namespace Director {
+
+static const char *const phaseNames[] = {
+	"lingo",
+	"channels",
+	"decode",
+	"text",
+	"transition",
+	"present"
+};
+
+static const char *const inkNames[] = {
+	"copy", "transparent", "reverse", "ghost", "notCopy",
+	"notTrans", "notReverse", "notGhost", "matte", "mask",
+	"blend", "addPin", "add", "subPin", "backgndTrans",
+	"light", "sub", "dark"
+};
+
+//Fails to compile when a phase or an ink is added without its name
+typedef char PhaseNamesMatch[ARRAYSIZE(phaseNames) == kPhaseBlit ? 1 : -1];
+typedef char InkNamesMatch[ARRAYSIZE(inkNames) == kPhaseCount - kPhaseBlit ? 1 : -1];
+
+PhaseProfiler::PhaseProfiler() {
+	reset();
+}
+
+void PhaseProfiler::reset() {
+	memset(_phases, 0, sizeof(_phases));
+	memset(_frame, 0, sizeof(_frame));
+	memset(_ran, 0, sizeof(_ran));
+	_current = kPhaseCount;
+	_since = g_system->getMillis();
+}
+
+ProfilePhase PhaseProfiler::enter(ProfilePhase phase) {
+	uint32 now = g_system->getMillis();
+	ProfilePhase previous = _current;
+
+	if (previous != kPhaseCount)
+		_frame[previous] += now - _since;
+
+	_current = phase;
+	_ran[phase] = true;
+	_since = now;
+
+	return previous;
+}
+
+void PhaseProfiler::leave(ProfilePhase previous) {
+	uint32 now = g_system->getMillis();
+
+	_frame[_current] += now - _since;
+	_current = previous;
+	_since = now;
+}
+
+void PhaseProfiler::endFrame() {
+	for (int i = 0; i < kPhaseCount; i++) {
+		if (_ran[i])
+			record((ProfilePhase)i, _frame[i]);
+	}
+
+	memset(_frame, 0, sizeof(_frame));
+	memset(_ran, 0, sizeof(_ran));
+}
+
+ProfilePhase PhaseProfiler::getBlitPhase(InkType ink) {
+	//Inks 10-31 aren't used, fold the arithmetic ones down after mask
+	int index = ink < kInkTypeBlend ? ink : ink - kInkTypeBlend + kInkTypeMask + 1;
+
+	return (ProfilePhase)(kPhaseBlit + CLIP(index, 0, kPhaseCount - kPhaseBlit - 1));
+}
+
+const char *PhaseProfiler::getPhaseName(int phase) {
+	if (phase < kPhaseBlit)
+		return phaseNames[phase];
+
+	return inkNames[phase - kPhaseBlit];
+}
+
+void PhaseProfiler::record(ProfilePhase phase, uint32 ms) {
+	Histogram &h = _phases[phase];
+
+	h.count++;
+	h.total += ms;
+	h.max = MAX(h.max, ms);
+	h.buckets[MIN<uint32>(ms, kProfileBuckets)]++;
+}
+
+uint32 PhaseProfiler::getPercentile(const Histogram &h, uint percent) {
+	//Smallest time at least that share of the samples fit in
+	uint32 target = (uint32)(((uint64)h.count * percent + 99) / 100);
+	uint32 seen = 0;
+
+	for (uint32 ms = 0; ms < kProfileBuckets; ms++) {
+		seen += h.buckets[ms];
+
+		if (seen >= target)
+			return ms;
+	}
+
+	return h.max;
+}
+
+void PhaseProfiler::dump() const {
+	debug("Phase timings in ms per frame:");
+	debug("%-14s %8s %8s %5s %5s %5s %5s", "phase", "frames", "total", "p50", "p95", "p99", "max");
+
+	for (int i = 0; i < kPhaseCount; i++) {
+		const Histogram &h = _phases[i];
+
+		if (!h.count)
+			continue;
+
+		Common::String name = i < kPhaseBlit ? getPhaseName(i) : Common::String("blit ") + getPhaseName(i);
+
+		debug("%-14s %8d %8d %5d %5d %5d %5d", name.c_str(), h.count, h.total,
+			getPercentile(h, 50), getPercentile(h, 95), getPercentile(h, 99), h.max);
+	}
+}
+
+} // End of namespace Director
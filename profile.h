@@ -0,0 +1,105 @@
+/* ScummVM - Graphic Adventure Engine
+ *
+ * ScummVM is the legal property of its developers, whose names
+ * are too numerous to list here. Please refer to the COPYRIGHT
+ * file distributed with this source distribution.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+ *
+ */
+
+#ifndef DIRECTOR_PROFILE_H
+#define DIRECTOR_PROFILE_H
+
+#include "common/system.h"
+
+#include "director/score.h"
+
+namespace Director {
+
+enum ProfilePhase {
+	kPhaseLingo,
+	kPhaseChannels,
+	kPhaseDecode,
+	kPhaseText,
+	kPhaseTransition,
+	kPhasePresent,
+	kPhaseBlit, // one per ink, see getBlitPhase()
+	kPhaseCount = kPhaseBlit + 18
+};
+
+// Samples are in milliseconds, the only clock OSystem has, so the many
+// short timings of a frame are added up and recorded once per frame.
+// Anything above the last bucket only counts towards the maximum.
+enum {
+	kProfileBuckets = 256
+};
+
+// Per-phase histograms of how long the parts of a frame take. Phases
+// nest, time is charged to the innermost one only.
+class PhaseProfiler {
+public:
+	PhaseProfiler();
+
+	static ProfilePhase getBlitPhase(InkType ink);
+
+	// Returns the phase that was running, to be passed to leave()
+	ProfilePhase enter(ProfilePhase phase);
+	void leave(ProfilePhase previous);
+	void endFrame();
+
+	void dump() const;
+	void reset();
+
+private:
+	struct Histogram {
+		uint32 count;
+		uint32 max;
+		uint32 total;
+		uint32 buckets[kProfileBuckets + 1];
+	};
+
+	static const char *getPhaseName(int phase);
+	static uint32 getPercentile(const Histogram &h, uint percent);
+
+	void record(ProfilePhase phase, uint32 ms);
+
+	Histogram _phases[kPhaseCount];
+	uint32 _frame[kPhaseCount]; // time spent in each phase this frame
+	bool _ran[kPhaseCount];
+	ProfilePhase _current; // kPhaseCount outside of any phase
+	uint32 _since;
+};
+
+// Times its scope into the given phase, does nothing without a profiler
+class ScopedPhaseTimer {
+public:
+	ScopedPhaseTimer(PhaseProfiler *profiler, ProfilePhase phase) : _profiler(profiler) {
+		_previous = profiler ? profiler->enter(phase) : kPhaseCount;
+	}
+
+	~ScopedPhaseTimer() {
+		if (_profiler)
+			_profiler->leave(_previous);
+	}
+
+private:
+	PhaseProfiler *_profiler;
+	ProfilePhase _previous;
+};
+
+} // End of namespace Director
+
+#endif
@@ -0,0 +1,186 @@
+/* ScummVM - Graphic Adventure Engine
+ *
+ * ScummVM is the legal property of its developers, whose names
+ * are too numerous to list here. Please refer to the COPYRIGHT
+ * file distributed with this source distribution.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+ *
+ */
+
+#include "common/system.h"
+#include "common/util.h"
+
+#include "director/director.h"
+#include "director/score.h"
+#include "director/sound.h"
+
+namespace Director {
+
+// Input can't be waited on, so never sleep longer than one poll interval.
+// A frame running this late restarts the timeline instead of catching up.
+enum {
+	kEventPollInterval = 10,
+	kSoundPollInterval = 10,
+	kMaxFrameLag = 250,
+	kMaxDroppedRun = 8 // frames dropped in a row at most, the next one is shown
+};
+
+void Score::scheduleFrame() {
+	//Turbo playback ignores the tempo channel, waits included, and
+	//goes to the next frame as soon as this one is done
+	if (_turbo)
+		return;
+
+	byte tempo = _frames[_currentFrame]->_tempo;
+
+	//Waits are only set up here, the main loop checks them between
+	//events, transitions and palette steps
+	if (tempo > 161) {
+		//Delay, counted from when the frame is shown
+		startTempoWait(kTempoWaitDelay, 0, g_system->getMillis() + (256 - tempo) * 1000);
+		return;
+	} else if (tempo && tempo <= 60) {
+		//FPS
+		_currentFrameRate = tempo;
+	} else if (tempo >= 136) {
+		//Wait for the digital video in channel tempo - 135
+		startTempoWait(kTempoWaitVideo, tempo - 135, 0);
+		return;
+	} else if (tempo == 128) {
+		//Wait for Click/Key
+		startTempoWait(kTempoWaitClick, 0, 0);
+		return;
+	} else if (tempo == 135) {
+		//Wait for sound channel 1
+		startTempoWait(kTempoWaitSound, 1, 0);
+		return;
+	} else if (tempo == 134) {
+		//Wait for sound channel 2
+		startTempoWait(kTempoWaitSound, 2, 0);
+		return;
+	}
+
+	uint32 interval = getFrameInterval();
+	uint32 now = g_system->getMillis();
+
+	if (_driftCompensation && _nextFrameTime && now - _nextFrameTime < kMaxFrameLag) {
+		//Step from when the frame was due rather than when it ran,
+		//so the time spent on it doesn't add up over the movie
+		uint32 due = _frameTimeRemainder + interval;
+
+		_nextFrameTime += due / 1000;
+		_frameTimeRemainder = due % 1000;
+	} else {
+		_nextFrameTime = now + (interval + 500) / 1000;
+		_frameTimeRemainder = 0;
+	}
+}
+
+uint32 Score::getFrameInterval() {
+	//In microseconds, 1000 / fps ms doesn't divide evenly for most rates
+	return 1000000 / MAX<byte>(_currentFrameRate, 1);
+}
+
+void Score::startTempoWait(TempoWait type, uint16 channel, uint32 until) {
+	_tempoWait = type;
+	_waitChannel = channel;
+	_waitUntil = until;
+
+	//Digital video isn't played, so its wait is over as soon as it starts
+	if (type == kTempoWaitVideo) {
+		debug(2, "Tempo wait for video channel %d ignored", channel);
+		endTempoWait();
+	}
+}
+
+bool Score::isTempoWaitPending() {
+	if (_tempoWait == kTempoWaitNone)
+		return false;
+
+	bool pending;
+
+	switch (_tempoWait) {
+	case kTempoWaitDelay:
+		pending = g_system->getMillis() < _waitUntil;
+		break;
+	case kTempoWaitSound:
+		pending = _soundManager->isChannelActive(_waitChannel);
+		break;
+	case kTempoWaitClick:
+	default:
+		//Cleared by processEvents()
+		pending = true;
+		break;
+	}
+
+	if (!pending)
+		endTempoWait();
+
+	return pending;
+}
+
+void Score::endTempoWait() {
+	_tempoWait = kTempoWaitNone;
+
+	//The playhead moves on as soon as the wait is over
+	_nextFrameTime = g_system->getMillis();
+	_frameTimeRemainder = 0;
+}
+
+bool Score::isFrameLate() {
+	if (_droppedRun >= kMaxDroppedRun)
+		return false;
+
+	//Drawing this frame would make the one after it late too.
+	//_nextFrameTime is still the time this frame was due, the next
+	//one is due an interval later as scheduleFrame() steps it
+	uint32 nextDue = _nextFrameTime + (_frameTimeRemainder + getFrameInterval()) / 1000;
+
+	return g_system->getMillis() + _frameCost > nextDue;
+}
+
+uint32 Score::getNextEventTime() {
+	uint32 due = _nextFrameTime;
+
+	if (_tempoWait == kTempoWaitDelay)
+		due = _waitUntil;
+	else if (_tempoWait == kTempoWaitSound)
+		due = g_system->getMillis() + kSoundPollInterval;
+	else if (_tempoWait == kTempoWaitClick)
+		due = g_system->getMillis() + kEventPollInterval;
+
+	//The next frame waits for the transition, so its steps come first
+	if (_transition.active) {
+		uint32 step = _transition.stepsDone + 1;
+
+		due = _transition.startTime + (uint32)(((uint64)step * _transition.duration + _transition.steps - 1) / _transition.steps);
+	}
+
+	if (_paletteEffect.active)
+		due = MIN(due, _paletteEffect.nextStep);
+
+	return due;
+}
+
+void Score::waitForNextEvent() {
+	uint32 now = g_system->getMillis();
+	uint32 due = getNextEventTime();
+
+	if (due > now)
+		g_system->delayMillis(MIN<uint32>(due - now, kEventPollInterval));
+}
+
+} // End of namespace Director
@@ -24,12 +24,17 @@
 #include "common/stream.h"
 #include "common/debug.h"
 #include "common/file.h"
+#include "common/hash-str.h"
 #include "common/archive.h"
 #include "common/config-manager.h"
 #include "common/unzip.h"
 
 #include "common/system.h"
+#include "director/bitd.h"
+#include "director/blend.h"
 #include "director/dib.h"
+#include "director/glyphs.h"
+#include "director/profile.h"
 #include "director/resource.h"
 #include "director/lingo/lingo.h"
 #include "director/sound.h"
@@ -38,7 +43,7 @@
 #include "common/events.h"
 #include "engines/util.h"
 #include "graphics/managed_surface.h"
-#include "image/bmp.h"
+#include "image/png.h"
 #include "graphics/fontman.h"
 #include "graphics/fonts/bdf.h"
 
@@ -115,12 +120,40 @@ Score::Score(DirectorEngine *vm) {
 	_vm = vm;
 	_surface = new Graphics::ManagedSurface;
 	_trailSurface = new Graphics::ManagedSurface;
+	_backSurface = new Graphics::ManagedSurface;
+	_coverageSurface = new Graphics::Surface;
+	_blendTables = new BlendTableCache;
 	_movieArchive = _vm->getMainArchive();
 	_lingo = _vm->getLingo();
 	_soundManager = _vm->getSoundManager();
 	_lingo->processEvent(kEventPrepareMovie, 0);
 	_movieScriptCount = 0;
 	_labels = NULL;
+	_transition.active = false;
+	memset(&_paletteEffect, 0, sizeof(_paletteEffect));
+	memset(&_lastPaletteInfo, 0, sizeof(_lastPaletteInfo));
+	_headless = false;
+	_screenChanged = false;
+	_compositeMode = kCompositeSerial;
+	_tileCount = 1;
+	_packBitmaps = false;
+	_driftCompensation = true;
+	_nextFrameTime = 0;
+	_frameTimeRemainder = 0;
+	_tempoWait = kTempoWaitNone;
+	_waitChannel = 0;
+	_waitUntil = 0;
+	_frameSkipping = false;
+	_turbo = false;
+	_turboInterval = 1;
+	_frameCost = 0;
+	_droppedFrames = 0;
+	_droppedRun = 0;
+	_longestDroppedRun = 0;
+	_checksumFile = nullptr;
+	_renderedFrames = 0;
+	_stageHash = 0;
+	_reusedFrames = 0;
 
 	if (_movieArchive->hasResource(MKTAG('M','C','N','M'), 0)) {
 		_macName = _movieArchive->getName(MKTAG('M','C','N','M'), 0).c_str();
@@ -139,15 +172,16 @@ void Score::loadArchive() {
 
 	if (clutList.size() == 0) {
 		warning("CLUT resource not found, using default Mac palette");
-		g_system->getPaletteManager()->setPalette(defaultPalette, 0, 256);
 		_vm->setPalette(defaultPalette, 256);
 	} else {
 		Common::SeekableSubReadStreamEndian *pal = _movieArchive->getResource(MKTAG('C', 'L', 'U', 'T'), clutList[0]);
 
 		loadPalette(*pal);
-		g_system->getPaletteManager()->setPalette(_vm->getPalette(), 0, _vm->getPaletteColorCount());
 	}
 
+	//Movies usually share their palette, so this is often a no-op
+	_vm->uploadPalette(_vm->getPalette(), 0, _vm->getPaletteColorCount());
+
 	assert(_movieArchive->hasResource(MKTAG('V','W','S','C'), 1024));
 	assert(_movieArchive->hasResource(MKTAG('V','W','C','F'), 1024));
 
@@ -171,6 +205,21 @@ void Score::loadArchive() {
 		loadFontMap(*_movieArchive->getResource(MKTAG('V','W','F','M'), 1024));
 	}
 
+	//Text casts keep their fonts, so rendering never looks them up by name
+	for (Common::HashMap<int, Cast *>::iterator i = _casts.begin(); i != _casts.end(); ++i)
+		if (i->_value->type == kCastText || i->_value->type == kCastButton)
+			resolveFont(static_cast<TextCast *>(i->_value));
+
+	for (Common::HashMap<int, Cast *>::iterator i = _casts.begin(); i != _casts.end(); ++i) {
+		if (i->_value->type != kCastFilmLoop)
+			continue;
+
+		if (_movieArchive->hasResource(MKTAG('S','C','V','W'), i->_key + 1024))
+			loadFilmLoop(static_cast<FilmLoopCast *>(i->_value), *_movieArchive->getResource(MKTAG('S','C','V','W'), i->_key + 1024));
+		else
+			warning("Film loop score %d not found", i->_key);
+	}
+
 	Common::Array<uint16> vwci = _movieArchive->getResourceIDList(MKTAG('V','W','C','I'));
 
 	if (vwci.size() > 0) {
@@ -198,8 +247,17 @@ Score::~Score() {
 	if (_trailSurface)
 		_trailSurface->free();
 
+	if (_backSurface)
+		_backSurface->free();
+
+	if (_coverageSurface)
+		_coverageSurface->free();
+
 	delete _surface;
 	delete _trailSurface;
+	delete _backSurface;
+	delete _coverageSurface;
+	delete _blendTables;
 
 	if (_movieArchive)
 		_movieArchive->close();
@@ -211,13 +269,26 @@ Score::~Score() {
 	delete _movieArchive;
 
 	delete _labels;
+	delete _checksumFile;
+
+	for (uint i = 0; i < _dissolveTables.size(); i++)
+		delete _dissolveTables[i];
+
+	for (uint i = 0; i < _glyphAtlases.size(); i++)
+		delete _glyphAtlases[i];
+
+	for (uint i = 0; i < _frames.size(); i++)
+		delete _frames[i];
+
+	for (Common::HashMap<int, Cast *>::iterator i = _casts.begin(); i != _casts.end(); ++i)
+		delete i->_value;
 }
 
 void Score::loadPalette(Common::SeekableSubReadStreamEndian &stream) {
 	uint16 steps = stream.size() / 6;
 	uint16 index = (steps * 3) - 1;
 	uint16 _paletteColorCount = steps;
-	byte *_palette = new byte[index];
+	byte *_palette = new byte[steps * 3];
 
 	for (uint8 i = 0; i < steps; i++) {
 		_palette[index - 2] = stream.readByte();
@@ -234,6 +305,10 @@ void Score::loadPalette(Common::SeekableSubReadStreamEndian &stream) {
 }
 
 void Score::loadFrames(Common::SeekableSubReadStreamEndian &stream) {
+	readFrames(stream, _frames);
+}
+
+void Score::readFrames(Common::SeekableSubReadStreamEndian &stream, Common::Array<Frame *> &frames) {
 	uint32 size = stream.readUint32();
 	size -= 4;
 
@@ -246,13 +321,13 @@ void Score::loadFrames(Common::SeekableSubReadStreamEndian &stream) {
 	uint16 channelOffset;
 
 	Frame *initial = new Frame(_vm);
-	_frames.push_back(initial);
+	frames.push_back(initial);
 
 	while (size != 0) {
 		uint16 frameSize = stream.readUint16();
 		size -= frameSize;
 		frameSize -= 2;
-		Frame *frame = new Frame(*_frames.back());
+		Frame *frame = new Frame(*frames.back());
 
 		while (frameSize != 0) {
 			if (_vm->getVersion() < 4) {
@@ -268,11 +343,12 @@ void Score::loadFrames(Common::SeekableSubReadStreamEndian &stream) {
 
 		}
 
-		_frames.push_back(frame);
+		frames.push_back(frame);
 	}
 
 	//remove initial frame
-	_frames.remove_at(0);
+	delete frames[0];
+	frames.remove_at(0);
 }
 
 void Score::loadConfig(Common::SeekableSubReadStreamEndian &stream) {
@@ -319,6 +395,12 @@ void Score::loadCastData(Common::SeekableSubReadStreamEndian &stream) {
 			_casts[id] = new ButtonCast(stream);
 			_casts[id]->type = kCastButton;
 			break;
+		case kCastFilmLoop:
+			_casts[id] = new FilmLoopCast(stream);
+			_casts[id]->type = kCastFilmLoop;
+			//Only the rect is known in there
+			stream.skip(size - 10);
+			break;
 		default:
 			warning("Unhandled cast type: %d", castType);
 			stream.skip(size - 1);
@@ -663,6 +745,37 @@ void Score::loadFontMap(Common::SeekableSubReadStreamEndian &stream) {
 	}
 }
 
+void Score::resolveFont(TextCast *textCast) {
+	Common::String name;
+
+	if (_fontMap.contains(textCast->fontId))
+		name = _fontMap[textCast->fontId];
+
+	//Sized BDF face first, then any face of that family, then the GUI font
+	const Graphics::Font *font = FontMan.getFontByName(Common::String::format("%s-%d", name.c_str(), textCast->fontSize));
+
+	if (!font)
+		font = FontMan.getFontByName(name);
+
+	if (!font) {
+		warning("Cannot load font %s, falling back to the GUI font", name.c_str());
+		font = FontMan.getFontByUsage(Graphics::FontManager::kBigGUIFont);
+	}
+
+	textCast->font = font;
+}
+
+GlyphAtlas *Score::getGlyphAtlas(const Graphics::Font *font) {
+	for (uint i = 0; i < _glyphAtlases.size(); i++)
+		if (_glyphAtlases[i]->getFont() == font)
+			return _glyphAtlases[i];
+
+	GlyphAtlas *atlas = new GlyphAtlas(font);
+	_glyphAtlases.push_back(atlas);
+
+	return atlas;
+}
+
 void Score::loadMacFonts() {
 	//Copy from Wage
 	Common::Archive *dat;
@@ -716,7 +829,11 @@ BitmapCast::BitmapCast(Common::SeekableSubReadStreamEndian &stream) {
 		/*uint16 unk1 =*/ stream.readUint16();
 		/*uint16 unk2 =*/ stream.readUint16();
 	}
-	modified = 0;
+	packed = nullptr;
+}
+
+BitmapCast::~BitmapCast() {
+	delete packed;
 }
 
 TextCast::TextCast(Common::SeekableSubReadStreamEndian &stream) {
@@ -741,7 +858,24 @@ TextCast::TextCast(Common::SeekableSubReadStreamEndian &stream) {
 		textFlags.push_back(kTextFlagDoNotWrap);
 	//again supposition
 	fontSize = stream.readUint16();
-	modified = 0;
+
+	font = nullptr;
+	textLoaded = false;
+	textHash = 0;
+}
+
+TextCast::~TextCast() {
+	for (uint i = 0; i < cache.size(); i++) {
+		cache[i]->surface.free();
+		delete cache[i];
+	}
+}
+
+void TextCast::setText(const Common::String &str) {
+	text = str;
+	textHash = Common::hashit(text.c_str());
+	textLoaded = true;
+	version++;
 }
 
 ShapeCast::ShapeCast(Common::SeekableSubReadStreamEndian &stream) {
@@ -755,7 +889,36 @@ ShapeCast::ShapeCast(Common::SeekableSubReadStreamEndian &stream) {
 	fillType = stream.readByte();
 	lineThickness = stream.readByte();
 	lineDirection = stream.readByte();
-	modified = 0;
+
+	if (fillType && shapeType != kShapeLine && !getPattern(pattern))
+		warning("Shape pattern %d is not a system pattern, it will be drawn solid", pattern);
+}
+
+ShapeCast::~ShapeCast() {
+	for (uint i = 0; i < spans.size(); i++)
+		delete spans[i];
+}
+
+FilmLoopCast::FilmLoopCast(Common::SeekableSubReadStreamEndian &stream) {
+	/*byte flags = */ stream.readByte();
+	initialRect = Score::readRect(stream);
+
+	keyColor = 0;
+	cacheOffset = Common::Point(0, 0);
+	memset(currentFrame, 0, sizeof(currentFrame));
+	memset(lastShown, 0, sizeof(lastShown));
+	cacheBuilt = false;
+	building = false;
+}
+
+FilmLoopCast::~FilmLoopCast() {
+	for (uint i = 0; i < cache.size(); i++) {
+		cache[i]->free();
+		delete cache[i];
+	}
+
+	for (uint i = 0; i < frames.size(); i++)
+		delete frames[i];
 }
 
 Common::Rect Score::readRect(Common::SeekableSubReadStreamEndian &stream) {
@@ -769,42 +932,197 @@ Common::Rect Score::readRect(Common::SeekableSubReadStreamEndian &stream) {
 }
 
 void Score::startLoop() {
-	initGraphics(_movieRect.width(), _movieRect.height(), true);
+	_headless = ConfMan.getBool("director_headless");
+	_frameDump = ConfMan.get("director_frame_dump");
+
+	Common::String compositor = ConfMan.get("director_compositor");
+
+	if (compositor == "tiled")
+		_compositeMode = kCompositeTiled;
+	else if (compositor == "compare")
+		_compositeMode = kCompositeCompare;
+	else
+		_compositeMode = kCompositeSerial;
+
+	_tileCount = CLIP(ConfMan.getInt("director_tiles"), 1, 64);
+	_packBitmaps = ConfMan.getBool("director_packed_bitmaps");
+	_driftCompensation = ConfMan.getBool("director_drift_compensation");
+	_frameSkipping = ConfMan.getBool("director_frame_skip");
+	_turbo = ConfMan.getBool("director_turbo");
+	_turboInterval = CLIP(ConfMan.getInt("director_turbo_present"), 1, 1000);
+
+	if (!_headless)
+		initGraphics(_movieRect.width(), _movieRect.height(), true);
 
 	_surface->create(_movieRect.width(), _movieRect.height());
 	_trailSurface->create(_movieRect.width(), _movieRect.height());
+	_backSurface->create(_movieRect.width(), _movieRect.height());
+	_coverageSurface->create(_movieRect.width(), _movieRect.height(), Graphics::PixelFormat::createFormatCLUT8());
 
 	if (_stageColor == 0)
 		_trailSurface->clear(_vm->getPaletteColorCount() - 1);
 	else
 		_trailSurface->clear(_stageColor);
 
+	_surface->copyFrom(*_trailSurface);
+	_dirtyRects.clear();
+
 	_currentFrame = 0;
 	_stopPlay = false;
 	_nextFrameTime = 0;
+	_frameTimeRemainder = 0;
+	_tempoWait = kTempoWaitNone;
+	_frameCost = 0;
+	_droppedFrames = 0;
+	_droppedRun = 0;
+	_longestDroppedRun = 0;
+
+	_renderedFrames = 0;
+	_stageHash = 0;
+	_reusedFrames = 0;
+	uint32 startTime = g_system->getMillis();
 
 	_lingo->processEvent(kEventStartMovie, 0);
-	_frames[_currentFrame]->prepareFrame(this);
+	_frames[_currentFrame]->prepareFrame(this, true);
+	_renderedFrames++;
+
+	if (!_frameDump.empty())
+		dumpFrame();
+
+	if (!_headless) {
+		startPaletteEffect(*_frames[_currentFrame]->_palette);
+		scheduleFrame();
+	}
 
 	while (!_stopPlay && _currentFrame < _frames.size() - 2) {
-		update();
+		//Palette effects only touch the colors, never the stage
+		if (!_headless)
+			stepPaletteEffect();
+
+		//The next frame waits until the running transition is complete
+		if (_transition.active)
+			stepTransition();
+		else
+			update();
+
 		processEvents();
 
-		g_system->updateScreen();
-		g_system->delayMillis(10);
+		//An idle movie only polls for events, turbo playback sends the
+		//stage every director_turbo_present frames
+		if (!_headless && _screenChanged) {
+			ScopedPhaseTimer timer(_vm->getProfiler(), kPhasePresent);
+			g_system->updateScreen();
+			_screenChanged = false;
+		}
+
+		if (!_headless && !_turbo)
+			waitForNextEvent();
+	}
+
+	if (_headless || _turbo)
+		debug(0, "Rendered %d frames in %d ms, %d unchanged", _renderedFrames, g_system->getMillis() - startTime, _reusedFrames);
+	else
+		debug(1, "%d of %d frames reused the previous stage", _reusedFrames, _renderedFrames);
+
+	if (_frameSkipping && !_headless)
+		debug(0, "Dropped %d of %d frames, at most %d in a row, %d ms per drawn frame", _droppedFrames, _renderedFrames, _longestDroppedRun, _frameCost);
+
+	if (_checksumFile) {
+		_checksumFile->finalize();
+		_checksumFile->close();
 	}
 }
 
+bool Score::reuseStage(uint32 displayHash) {
+	bool reuse = displayHash != 0 && displayHash == _stageHash;
+
+	_stageHash = displayHash;
+
+	if (reuse)
+		_reusedFrames++;
+
+	return reuse;
+}
+
+void Score::dumpFrame() {
+	const Graphics::Surface &stage = _surface->rawSurface();
+
+	if (_frameDump == "checksum") {
+		if (!_checksumFile) {
+			_checksumFile = new Common::DumpFile();
+
+			Common::String name = Common::String::format("./dumps/%s-checksums.txt", _macName.c_str());
+
+			if (!_checksumFile->open(name, true)) {
+				warning("Can not open dump file %s", name.c_str());
+				_frameDump.clear();
+				return;
+			}
+		}
+
+		//Adler-32 of the stage pixels
+		uint32 a = 1, b = 0;
+
+		for (int y = 0; y < stage.h; y++) {
+			const byte *row = (const byte *)stage.getBasePtr(0, y);
+
+			for (int x = 0; x < stage.w; x++) {
+				a = (a + row[x]) % 65521;
+				b = (b + a) % 65521;
+			}
+		}
+
+		_checksumFile->writeString(Common::String::format("%d %08x\n", _currentFrame, (b << 16) | a));
+		return;
+	}
+
+	Common::DumpFile out;
+	bool png = (_frameDump == "png");
+	Common::String name = Common::String::format("./dumps/%s-frame-%05d.%s", _macName.c_str(), _currentFrame, png ? "png" : "raw");
+
+	if (!out.open(name, true)) {
+		warning("Can not open dump file %s", name.c_str());
+		return;
+	}
+
+	if (png) {
+#ifdef USE_PNG
+		byte palette[768];
+		memset(palette, 0, sizeof(palette));
+		memcpy(palette, _vm->getPalette(), MIN<uint>(_vm->getPaletteColorCount(), 256) * 3);
+
+		Graphics::Surface *rgb = stage.convertTo(Graphics::PixelFormat(3, 8, 8, 8, 0, 16, 8, 0, 0), palette);
+		Image::writePNG(out, *rgb);
+		rgb->free();
+		delete rgb;
+#else
+		warning("PNG support is not compiled in, frame %d not dumped", _currentFrame);
+#endif
+	} else {
+		for (int y = 0; y < stage.h; y++)
+			out.write(stage.getBasePtr(0, y), stage.w);
+	}
+
+	out.flush();
+	out.close();
+}
+
 void Score::update() {
-	if (g_system->getMillis() < _nextFrameTime)
+	if (!_headless && (isTempoWaitPending() || g_system->getMillis() < _nextFrameTime))
 		return;
 
-	_surface->clear();
-	_surface->copyFrom(*_trailSurface);
+	//Everything since the last frame started, waits and transition
+	//steps included, is counted towards that frame
+	if (_vm->getProfiler())
+		_vm->getProfiler()->endFrame();
 
 	//Enter and exit from previous frame (Director 4)
-	_lingo->processEvent(kEventEnterFrame, _currentFrame);
-	_lingo->processEvent(kEventExitFrame, _currentFrame);
+	{
+		ScopedPhaseTimer timer(_vm->getProfiler(), kPhaseLingo);
+
+		_lingo->processEvent(kEventEnterFrame, _currentFrame);
+		_lingo->processEvent(kEventExitFrame, _currentFrame);
+	}
 	//TODO Director 6 - another order
 
 
@@ -825,45 +1143,52 @@ void Score::update() {
 		}
 	}
 
-	_frames[_currentFrame]->prepareFrame(this);
-	//Stage is drawn between the prepareFrame and enterFrame events (Lingo in a Nutshell)
+	//Lingo and sound always run, only drawing the stage can be dropped
+	bool present;
 
-	byte tempo = _frames[_currentFrame]->_tempo;
+	if (_turbo && !_headless)
+		present = (_renderedFrames + 1) % _turboInterval == 0;
+	else
+		present = !_frameSkipping || _headless || !isFrameLate();
 
-	if (tempo) {
-		if (tempo > 161) {
-			//Delay
-			_nextFrameTime = g_system->getMillis() + (256 - tempo) * 1000;
+	//A dropped frame leaves the previous stage behind, dumps need them all
+	if (!_frameDump.empty())
+		present = true;
 
-			return;
-		} else if (tempo <= 60) {
-			//FPS
-			_nextFrameTime = g_system->getMillis() + (float)tempo / 60 * 1000;
-			_currentFrameRate = tempo;
-		} else if (tempo >= 136) {
-			//TODO Wait for channel tempo - 135
-		} else if (tempo == 128) {
-			//TODO Wait for Click/Key
-		} else if (tempo == 135) {
-			//Wait for sound channel 1
-			while (_soundManager->isChannelActive(1)) {
-				processEvents();
-				g_system->delayMillis(10);
-			}
-		} else if (tempo == 134) {
-			//Wait for sound channel 2
-			while (_soundManager->isChannelActive(2)) {
-				processEvents();
-				g_system->delayMillis(10);
-			}
-		}
+	uint32 start = g_system->getMillis();
+
+	bool rendered = _frames[_currentFrame]->prepareFrame(this, present);
+	//Stage is drawn between the prepareFrame and enterFrame events (Lingo in a Nutshell)
+	_renderedFrames++;
+
+	if (rendered)
+		_frameCost = (_frameCost * 7 + (g_system->getMillis() - start)) / 8;
+
+	if (!present && !rendered) {
+		_droppedFrames++;
+		_droppedRun++;
+		_longestDroppedRun = MAX(_longestDroppedRun, _droppedRun);
+	} else {
+		_droppedRun = 0;
 	}
-	_nextFrameTime = g_system->getMillis() + (float)_currentFrameRate / 60 * 1000;
+
+	if (!_frameDump.empty())
+		dumpFrame();
+
+	//Headless playback runs as fast as possible
+	if (_headless)
+		return;
+
+	startPaletteEffect(*_frames[_currentFrame]->_palette);
+	scheduleFrame();
 }
 
 void Score::processEvents() {
-	if (_currentFrame > 0)
+	if (_currentFrame > 0) {
+		ScopedPhaseTimer timer(_vm->getProfiler(), kPhaseLingo);
+
 		_lingo->processEvent(kEventIdle, _currentFrame - 1);
+	}
 
 	Common::Event event;
 
@@ -871,6 +1196,15 @@ void Score::processEvents() {
 		if (event.type == Common::EVENT_QUIT)
 			_stopPlay = true;
 
+		//The backend draws the cursor when the screen is updated
+		if (event.type == Common::EVENT_MOUSEMOVE)
+			_screenChanged = true;
+
+		if (event.type == Common::EVENT_LBUTTONDOWN || event.type == Common::EVENT_KEYDOWN) {
+			if (_tempoWait == kTempoWaitClick)
+				endTempoWait();
+		}
+
 		if (event.type == Common::EVENT_LBUTTONDOWN) {
 			Common::Point pos = g_system->getEventManager()->getMousePos();
 
@@ -911,6 +1245,7 @@ Frame::Frame(DirectorEngine *vm) {
 	_actionId = 0;
 	_skipFrameFlag = 0;
 	_blend = 0;
+	_palette = new PaletteInfo();
 
 	_sprites.resize(CHANNEL_COUNT);
 
@@ -918,6 +1253,8 @@ Frame::Frame(DirectorEngine *vm) {
 		Sprite *sp = new Sprite();
 		_sprites[i] = sp;
 	}
+
+	resetHitIndex(Common::Rect());
 }
 
 Frame::Frame(const Frame &frame) {
@@ -934,18 +1271,21 @@ Frame::Frame(const Frame &frame) {
 	_soundType2 = frame._soundType2;
 	_skipFrameFlag = frame._skipFrameFlag;
 	_blend = frame._blend;
-	_palette = new PaletteInfo();
+	_palette = new PaletteInfo(*frame._palette);
 
 	_sprites.resize(CHANNEL_COUNT);
 
 	for (uint16 i = 0; i < CHANNEL_COUNT; i++) {
 		_sprites[i] = new Sprite(*frame._sprites[i]);
 	}
+
+	resetHitIndex(Common::Rect());
 }
 
 Frame::~Frame() {
-	delete[] &_sprites;
-	delete[] &_drawRects;
+	for (uint16 i = 0; i < _sprites.size(); i++)
+		delete _sprites[i];
+
 	delete _palette;
 }
 
@@ -1026,9 +1366,15 @@ void Frame::readMainChannels(Common::SeekableSubReadStreamEndian &stream, uint16
 			offset += 1;
 			break;
 		case kPaletePosition:
-			if (stream.readUint16())
+			_palette->paletteId = stream.readUint16();
+
+			if (_palette->paletteId)
 				readPaletteInfo(stream);
+			else
+				stream.skip(14);
+
 			offset += 16;
+			break;
 		default:
 			offset++;
 			stream.readByte();
@@ -1110,19 +1456,79 @@ void Frame::readSprite(Common::SeekableSubReadStreamEndian &stream, uint16 offse
 	}
 }
 
-void Frame::prepareFrame(Score *score) {
-	renderSprites(*score->_surface, false);
-	renderSprites(*score->_trailSurface, true);
+bool Frame::prepareFrame(Score *score, bool present) {
+	Common::Rect stage(score->_movieRect.width(), score->_movieRect.height());
+	resetHitIndex(stage);
+
+	Common::Array<RenderItem> items;
+	PhaseProfiler *profiler = _vm->getProfiler();
+
+	{
+		ScopedPhaseTimer timer(profiler, kPhaseChannels);
+		buildRenderList(items, stage);
+	}
+
+	//Trails and transitions change what the following frames are drawn
+	//over, so those frames are never dropped. Turbo playback skips transitions
+	bool drop = !present && (_transType == 0 || score->isTurbo());
+
+	for (uint i = 0; i < items.size(); i++)
+		if (_sprites[items[i].spriteId]->_trails)
+			drop = false;
+
+	//The same display list over the same trail layer gives the same stage,
+	//so there is nothing to composite or present. A dropped frame leaves
+	//the stage behind, so the next one can't reuse it
+	uint32 hash = (drop || _transType != 0) ? 0 : hashRenderList(items);
+
+	if (score->reuseStage(hash) || drop) {
+		for (uint i = 0; i < items.size(); i++)
+			if (items[i].cast->type != kCastText && items[i].cast->type != kCastButton)
+				addHitRect(items[i].rect, items[i].spriteId);
+
+		freeRenderList(items);
+
+		if (_sound1 != 0 || _sound2 != 0)
+			playSoundChannel();
 
+		return false;
+	}
+
+	{
+		ScopedPhaseTimer timer(profiler, kPhaseDecode);
+		decodeRenderList(items);
+	}
+
+	for (uint i = 0; i < items.size(); i++)
+		if (items[i].cast->type != kCastText && items[i].cast->type != kCastButton)
+			addHitRect(items[i].rect, items[i].spriteId);
+
+	//Push and reveal transitions move the previous stage around
 	if (_transType != 0)
+		score->_backSurface->blitFrom(*score->_surface);
+
+	renderSprites(*score->_surface, *score->_trailSurface, items);
+	freeRenderList(items);
+
+	if (_transType != 0 && !score->isHeadless() && !score->isTurbo()) {
+		ScopedPhaseTimer timer(profiler, kPhaseTransition);
+
 		//TODO Handle changing area case
 		playTransition(score);
+	}
 
 	if (_sound1 != 0 || _sound2 != 0) {
 		playSoundChannel();
 	}
 
-	g_system->copyRectToScreen(score->_surface->getPixels(), score->_surface->pitch, 0, 0, score->_surface->getBounds().width(), score->_surface->getBounds().height());
+	//The transition presents the new stage step by step
+	if (!score->isHeadless() && !score->isTransitionActive()) {
+		ScopedPhaseTimer timer(profiler, kPhasePresent);
+		g_system->copyRectToScreen(score->_surface->getPixels(), score->_surface->pitch, 0, 0, score->_surface->getBounds().width(), score->_surface->getBounds().height());
+		score->_screenChanged = true;
+	}
+
+	return true;
 }
 
 void Frame::playSoundChannel() {
@@ -1130,156 +1536,135 @@ void Frame::playSoundChannel() {
 	debug(0, "Sound1 %d", _sound1);
 }
 
-void Frame::playTransition(Score *score) {
-	uint16 duration = _transDuration * 250; // _transDuration in 1/4 of sec
-	duration = (duration == 0 ? 250 : duration); // director support transition duration = 0, but animation play like value = 1, idk.
-
-	if (_transChunkSize == 0)
-		_transChunkSize = 1; //equal 1 step
+void Frame::renderSprites(Graphics::ManagedSurface &surface, Graphics::ManagedSurface &trailSurface, Common::Array<RenderItem> &items) {
+	Score *score = _vm->_currentScore;
+	Common::Rect stage(surface.w, surface.h);
 
-	uint16 stepDuration = duration / _transChunkSize;
-	uint16 steps = duration / stepDuration;
+	//Non-trail sprites of the previous frame are the only difference
+	//between the stage and the trail layer, so restore just those areas
+	Common::Array<Common::Rect> restoreRects = score->_dirtyRects;
+	score->_dirtyRects.clear();
 
-	switch (_transType) {
-	case kTransCoverDown:
-		{
-			uint16 stepSize = score->_movieRect.height() / steps;
-			Common::Rect r = score->_movieRect;
-
-			for (uint16 i = 1; i < steps; i++) {
-				r.setHeight(stepSize * i);
-
-				g_system->delayMillis(stepDuration);
-				score->processEvents();
+	for (uint i = 0; i < items.size(); i++) {
+		if (!_sprites[items[i].spriteId]->_trails)
+			score->_dirtyRects.push_back(items[i].rect);
+	}
 
-				g_system->copyRectToScreen(score->_surface->getPixels(), score->_surface->pitch, 0, 0, r.width(), r.height());
-				g_system->updateScreen();
-			}
-		}
+	switch (score->getCompositeMode()) {
+	case kCompositeTiled:
+		compositeTiles(surface, trailSurface, items, restoreRects, score->getTileCount());
 		break;
-	case kTransCoverUp:
-		{
-			uint16 stepSize = score->_movieRect.height() / steps;
-			Common::Rect r = score->_movieRect;
+	case kCompositeCompare:
+		compareComposite(surface, trailSurface, items, restoreRects, score->getTileCount());
+		break;
+	default:
+		compositeRegion(surface, &trailSurface, items, restoreRects, stage);
+		break;
+	}
+}
 
-			for (uint16 i = 1; i < steps; i++) {
-				r.setHeight(stepSize * i);
+void Frame::composite(Graphics::ManagedSurface &surface, const Common::Rect &clip) {
+	Common::Array<RenderItem> items;
 
-				g_system->delayMillis(stepDuration);
-				score->processEvents();
+	buildRenderList(items, clip);
+	decodeRenderList(items);
+	compositeRegion(surface, nullptr, items, Common::Array<Common::Rect>(), clip);
+	freeRenderList(items);
+}
 
-				g_system->copyRectToScreen(score->_surface->getPixels(), score->_surface->pitch, 0, score->_movieRect.height() - stepSize * i, r.width(), r.height());
-				g_system->updateScreen();
-			}
-		}
-		break;
-	case kTransCoverRight: {
-			uint16 stepSize = score->_movieRect.width() / steps;
-			Common::Rect r = score->_movieRect;
+void Frame::decodeRenderList(Common::Array<RenderItem> &items) {
+	for (uint i = 0; i < items.size(); i++) {
+		RenderItem &item = items[i];
 
-			for (uint16 i = 1; i < steps; i++) {
-				r.setWidth(stepSize * i);
+		if (item.image || item.packed || item.cast->type == kCastText || item.cast->type == kCastButton || item.cast->type == kCastShape)
+			continue;
 
-				g_system->delayMillis(stepDuration);
-				score->processEvents();
+		BitmapCast *bitmap = static_cast<BitmapCast *>(item.cast);
+		uint16 castId = _sprites[item.spriteId]->_castId;
 
-				g_system->copyRectToScreen(score->_surface->getPixels(), score->_surface->pitch, 0, 0, r.width(), r.height());
-				g_system->updateScreen();
-			}
+		//An earlier sprite of the list may have packed the same cast already
+		if (bitmap->packed) {
+			item.packed = bitmap->packed;
+			continue;
 		}
-		break;
-	case kTransCoverLeft: {
-			uint16 stepSize = score->_movieRect.width() / steps;
-			Common::Rect r = score->_movieRect;
-
-			for (uint16 i = 1; i < steps; i++) {
-				r.setWidth(stepSize * i);
 
-				g_system->delayMillis(stepDuration);
-				score->processEvents();
+		item.decoder = getImageFrom(castId, bitmap);
 
-				g_system->copyRectToScreen(score->_surface->getPixels(), score->_surface->pitch, score->_movieRect.width() - stepSize * i, 0, r.width(), r.height());
-				g_system->updateScreen();
-			}
+		if (!item.decoder || !item.decoder->getSurface()) {
+			warning("Image with id %d could not be decoded", castId);
+			delete item.decoder;
+			items.remove_at(i--);
+			continue;
 		}
-		break;
-	case kTransCoverUpLeft: {
-			uint16 stepSize = score->_movieRect.width() / steps;
-			Common::Rect r = score->_movieRect;
 
-			for (uint16 i = 1; i < steps; i++) {
-				r.setWidth(stepSize * i);
-				r.setHeight(stepSize * i);
+		item.image = item.decoder->getSurface();
 
-				g_system->delayMillis(stepDuration);
-				score->processEvents();
-
-				g_system->copyRectToScreen(score->_surface->getPixels(), score->_surface->pitch, score->_movieRect.width() - stepSize * i, score->_movieRect.height() - stepSize * i, r.width(), r.height());
-				g_system->updateScreen();
-			}
+		//Packed on the first decode, the decoder is no longer needed
+		if (bitmap->packed) {
+			delete item.decoder;
+			item.decoder = nullptr;
+			item.image = nullptr;
+			item.packed = bitmap->packed;
 		}
-		break;
-	case kTransCoverUpRight: {
-			uint16 stepSize = score->_movieRect.width() / steps;
-			Common::Rect r = score->_movieRect;
+	}
+}
 
-			for (uint16 i = 1; i < steps; i++) {
-				r.setWidth(stepSize * i);
-				r.setHeight(stepSize * i);
+uint32 Frame::hashRenderList(const Common::Array<RenderItem> &items) {
+	//Film loops move on every frame, trails change the layer under the stage.
+	//Blend inks depend on the palette, so it is part of the list too
+	uint32 hash = (2166136261u ^ _blend) * 16777619u ^ _palette->paletteId;
 
-				g_system->delayMillis(stepDuration);
-				score->processEvents();
+	for (uint i = 0; i < items.size(); i++) {
+		const RenderItem &item = items[i];
+		const Sprite *sprite = _sprites[item.spriteId];
 
-				g_system->copyRectToScreen(score->_surface->getPixels(), score->_surface->pitch, 0, score->_movieRect.height() - stepSize * i, r.width(), r.height());
-				g_system->updateScreen();
-			}
-		}
-		break;
-	case kTransCoverDownLeft: {
-			uint16 stepSize = score->_movieRect.width() / steps;
-			Common::Rect r = score->_movieRect;
+		if (sprite->_trails || item.cast->type == kCastFilmLoop)
+			return 0;
 
-			for (uint16 i = 1; i < steps; i++) {
-				r.setWidth(stepSize * i);
-				r.setHeight(stepSize * i);
+		uint32 fields[8];
+		int count = 0;
 
-				g_system->delayMillis(stepDuration);
-				score->processEvents();
+		fields[count++] = item.spriteId;
+		fields[count++] = (uint32)(size_t)item.cast;
+		fields[count++] = item.cast->version << 8 | sprite->_ink;
+		fields[count++] = (uint16)item.rect.left << 16 | (uint16)item.rect.top;
+		fields[count++] = (uint16)item.rect.right << 16 | (uint16)item.rect.bottom;
 
-				g_system->copyRectToScreen(score->_surface->getPixels(), score->_surface->pitch, score->_movieRect.width() - stepSize * i, 0, r.width(), r.height());
-				g_system->updateScreen();
-			}
+		if (item.cast->type == kCastText || item.cast->type == kCastButton) {
+			fields[count++] = item.text ? item.text->key : 0;
+		} else if (item.cast->type == kCastShape) {
+			const ShapeCast *shape = static_cast<ShapeCast *>(item.cast);
+
+			fields[count++] = shape->shapeType << 24 | shape->fgCol << 16 | shape->bgCol << 8 | shape->fillType;
+			fields[count++] = shape->pattern << 16 | shape->lineThickness << 8 | shape->lineDirection;
 		}
-		break;
-	case kTransCoverDownRight: {
-			uint16 stepSize = score->_movieRect.width() / steps;
-			Common::Rect r = score->_movieRect;
 
-			for (uint16 i = 1; i < steps; i++) {
-				r.setWidth(stepSize * i);
-				r.setHeight(stepSize * i);
+		for (int j = 0; j < count; j++)
+			hash = (hash ^ fields[j]) * 16777619u;
+	}
 
-				g_system->delayMillis(stepDuration);
-				score->processEvents();
+	//0 is kept for lists that can't be reused
+	return hash ? hash : 1;
+}
 
-				g_system->copyRectToScreen(score->_surface->getPixels(), score->_surface->pitch, 0, 0, r.width(), r.height());
-				g_system->updateScreen();
-			}
+void Frame::freeRenderList(Common::Array<RenderItem> &items) {
+	for (uint i = 0; i < items.size(); i++) {
+		delete items[i].decoder;
+
+		if (items[i].matteMask) {
+			items[i].matteMask->free();
+			delete items[i].matteMask;
 		}
-		break;
-	default:
-		warning("Unhandled transition type %d %d %d", _transType, duration, _transChunkSize);
-		break;
 
+		_vm->getSurfacePool()->release(items[i].expanded);
 	}
+
+	items.clear();
 }
 
-void Frame::renderSprites(Graphics::ManagedSurface &surface, bool renderTrail) {
+void Frame::buildRenderList(Common::Array<RenderItem> &items, const Common::Rect &stage) {
 	for (uint16 i = 0; i < CHANNEL_COUNT; i++) {
 		if (_sprites[i]->_enabled) {
-			if ((_sprites[i]->_trails == 0 && renderTrail) || (_sprites[i]->_trails == 1 && !renderTrail))
-				continue;
-
 			Cast *cast;
 			if (!_vm->_currentScore->_casts.contains(_sprites[i]->_castId)) {
 				if (!_vm->getSharedCasts()->contains(_sprites[i]->_castId)) {
@@ -1292,107 +1677,280 @@ void Frame::renderSprites(Graphics::ManagedSurface &surface, bool renderTrail) {
 				cast = _vm->_currentScore->_casts[_sprites[i]->_castId];
 			}
 
-			if (cast->type == kCastText) {
-				renderText(surface, i);
-				continue;
-			}
+			RenderItem item;
+			item.spriteId = i;
+			item.cast = cast;
+			item.decoder = nullptr;
+			item.image = nullptr;
+			item.matteMask = nullptr;
+			item.packed = nullptr;
+			item.expanded = nullptr;
+			item.spans = nullptr;
+			item.text = nullptr;
+
+			if (cast->type == kCastText || cast->type == kCastButton) {
+				item.text = prepareText(i, static_cast<TextCast *>(cast), item.rect);
+			} else if (cast->type == kCastShape) {
+				item.spans = prepareShape(i, static_cast<ShapeCast *>(cast), item.rect);
+			} else if (cast->type == kCastFilmLoop) {
+				item.image = _vm->_currentScore->getFilmLoopFrame(static_cast<FilmLoopCast *>(cast), i);
+
+				if (!item.image)
+					continue;
 
-			Image::ImageDecoder *img = getImageFrom(_sprites[i]->_castId);
+				//Film loops are registered on their center. Only their part
+				//on the stage is cached, offset within the whole loop
+				FilmLoopCast *loop = static_cast<FilmLoopCast *>(cast);
+				int x = _sprites[i]->_startPoint.x - loop->initialRect.width() / 2 + loop->cacheOffset.x;
+				int y = _sprites[i]->_startPoint.y - loop->initialRect.height() / 2 + loop->cacheOffset.y;
 
-			if (!img) {
-				warning("Image with id %d not found", _sprites[i]->_castId);
-				continue;
-			}
+				item.rect = Common::Rect(x, y, x + item.image->w, y + item.image->h);
+			} else {
+				uint32 regX = static_cast<BitmapCast *>(_sprites[i]->_cast)->regX;
+				uint32 regY = static_cast<BitmapCast *>(_sprites[i]->_cast)->regY;
+				uint32 rectLeft = static_cast<BitmapCast *>(_sprites[i]->_cast)->initialRect.left;
+				uint32 rectTop = static_cast<BitmapCast *>(_sprites[i]->_cast)->initialRect.top;
 
-			uint32 regX = static_cast<BitmapCast *>(_sprites[i]->_cast)->regX;
-			uint32 regY = static_cast<BitmapCast *>(_sprites[i]->_cast)->regY;
-			uint32 rectLeft = static_cast<BitmapCast *>(_sprites[i]->_cast)->initialRect.left;
-			uint32 rectTop = static_cast<BitmapCast *>(_sprites[i]->_cast)->initialRect.top;
+				int x = _sprites[i]->_startPoint.x - regX + rectLeft;
+				int y = _sprites[i]->_startPoint.y - regY + rectTop;
+				int height = _sprites[i]->_height;
+				int width = _sprites[i]->_width;
 
-			int x = _sprites[i]->_startPoint.x - regX + rectLeft;
-			int y = _sprites[i]->_startPoint.y - regY + rectTop;
-			int height = _sprites[i]->_height;
-			int width = _sprites[i]->_width;
+				item.rect = Common::Rect(x, y, x + width, y + height);
 
-			Common::Rect drawRect = Common::Rect(x, y, x + width, y + height);
-			_drawRects.push_back(drawRect);
+				//Nothing of it is visible, don't bother decoding
+				if (!item.rect.intersects(stage))
+					continue;
 
-			switch (_sprites[i]->_ink) {
-			case kInkTypeCopy:
-				surface.blitFrom(*img->getSurface(), Common::Point(x, y));
-				break;
-			case kInkTypeBackgndTrans:
-				drawBackgndTransSprite(surface, *img->getSurface(), drawRect);
-				break;
-			case kInkTypeMatte:
-				drawMatteSprite(surface, *img->getSurface(), drawRect);
-				break;
-			case kInkTypeGhost:
-				drawGhostSprite(surface, *img->getSurface(), drawRect);
-				break;
-			case kInkTypeReverse:
-				drawReverseSprite(surface, *img->getSurface(), drawRect);
-				break;
-			default:
-				warning("Unhandled ink type %d", _sprites[i]->_ink);
-				surface.blitFrom(*img->getSurface(), Common::Point(x, y));
-				break;
+				//Decoded later, once the list is known to be drawn
+				item.packed = static_cast<BitmapCast *>(cast)->packed;
 			}
+
+			items.push_back(item);
 		}
 	}
 }
 
-void Frame::renderButton(Graphics::ManagedSurface &surface, uint16 spriteId) {
-	renderText(surface, spriteId);
+void Frame::compositeRegion(Graphics::ManagedSurface &surface, Graphics::ManagedSurface *trailSurface, Common::Array<RenderItem> &items, const Common::Array<Common::Rect> &restoreRects, const Common::Rect &clip) {
+	for (uint16 i = 0; i < restoreRects.size(); i++) {
+		Common::Rect r = restoreRects[i];
+		r.clip(clip);
 
-	uint16 castID = _sprites[spriteId]->_castId;
-	ButtonCast *button = static_cast<ButtonCast *>(_vm->_currentScore->_casts[castID]);
+		if (!r.isEmpty())
+			surface.blitFrom(*trailSurface, r, Common::Point(r.left, r.top));
+	}
 
-	uint32 rectLeft = button->initialRect.left;
-	uint32 rectTop = button->initialRect.top;
+	Graphics::Surface *coverage = _vm->_currentScore->_coverageSurface;
 
-	int x = _sprites[spriteId]->_startPoint.x + rectLeft;
-	int y = _sprites[spriteId]->_startPoint.y + rectTop;
-	int height = _sprites[spriteId]->_height;
-	int width = _sprites[spriteId]->_width;
+	for (int y = clip.top; y < clip.bottom; y++)
+		memset(coverage->getBasePtr(clip.left, y), 0, clip.width());
 
-	switch (button->buttonType) {
-	case kTypeCheckBox:
-		//Magic numbers: checkbox square need to move left about 5px from text and 12px side size (d4)
-		surface.frameRect(Common::Rect(x - 17, y, x + 12, y + 12), 0);
+	for (uint i = 0; i < items.size(); i++) {
+		RenderItem &item = items[i];
+		bool trails = trailSurface && _sprites[item.spriteId]->_trails;
+
+		if (!item.rect.intersects(clip))
+			continue;
+
+		//Trail sprites go to the persistent trail layer as well
+		if (item.cast->type == kCastText || item.cast->type == kCastButton) {
+			drawCachedText(surface, item, clip);
+
+			if (trails)
+				drawCachedText(*trailSurface, item, clip);
+
+			continue;
+		}
+
+		if (item.cast->type == kCastShape) {
+			drawShape(surface, item, clip);
+
+			if (trails)
+				drawShape(*trailSurface, item, clip);
+		} else if (item.cast->type == kCastFilmLoop) {
+			drawFilmLoop(surface, item, clip);
+
+			if (trails)
+				drawFilmLoop(*trailSurface, item, clip);
+		} else {
+			drawSprite(surface, item, clip);
+
+			if (trails)
+				drawSprite(*trailSurface, item, clip);
+		}
+
+		Common::Rect covered = item.rect;
+		covered.clip(clip);
+		markCoverage(covered, item.spriteId);
+	}
+}
+
+void Frame::compositeTiles(Graphics::ManagedSurface &surface, Graphics::ManagedSurface &trailSurface, Common::Array<RenderItem> &items, const Common::Array<Common::Rect> &restoreRects, uint16 tiles) {
+	//A pixel only depends on the sprites over it, drawn in channel order,
+	//so bands can be composited independently and give the serial result.
+	//There are no threads to run them on, they are composited one after
+	//another
+	int bandHeight = (surface.h + tiles - 1) / tiles;
+
+	for (int top = 0; top < surface.h; top += bandHeight)
+		compositeRegion(surface, &trailSurface, items, restoreRects, Common::Rect(0, top, surface.w, MIN<int>(top + bandHeight, surface.h)));
+}
+
+static bool sameSurfaces(const Graphics::ManagedSurface &a, const Graphics::ManagedSurface &b) {
+	for (int y = 0; y < a.h; y++)
+		if (memcmp(a.getBasePtr(0, y), b.getBasePtr(0, y), a.w))
+			return false;
+
+	return true;
+}
+
+void Frame::compareComposite(Graphics::ManagedSurface &surface, Graphics::ManagedSurface &trailSurface, Common::Array<RenderItem> &items, const Common::Array<Common::Rect> &restoreRects, uint16 maxTiles) {
+	//Run the serial path for real, then every band count up to maxTiles
+	//on copies of the same input, timing each and checking they all come
+	//out identical
+	Graphics::ManagedSurface stage, trail;
+	stage.copyFrom(surface);
+	trail.copyFrom(trailSurface);
+
+	uint32 start = g_system->getMillis();
+	compositeRegion(surface, &trailSurface, items, restoreRects, Common::Rect(surface.w, surface.h));
+	debug(1, "Frame composited serially in %d ms", g_system->getMillis() - start);
+
+	Graphics::ManagedSurface tiledStage, tiledTrail;
+
+	for (uint16 tiles = 1; tiles <= maxTiles; tiles++) {
+		tiledStage.copyFrom(stage);
+		tiledTrail.copyFrom(trail);
+
+		start = g_system->getMillis();
+		compositeTiles(tiledStage, tiledTrail, items, restoreRects, tiles);
+		debug(1, "Frame composited in %d bands in %d ms", tiles, g_system->getMillis() - start);
+
+		if (!sameSurfaces(surface, tiledStage) || !sameSurfaces(trailSurface, tiledTrail))
+			warning("Compositing in %d bands differs from the serial result", tiles);
+	}
+}
+
+void Frame::drawSprite(Graphics::ManagedSurface &target, RenderItem &item, const Common::Rect &clip) {
+	const Common::Rect &drawRect = item.rect;
+	InkType ink = _sprites[item.spriteId]->_ink;
+	ScopedPhaseTimer timer(_vm->getProfiler(), PhaseProfiler::getBlitPhase(ink));
+
+	//Packed bitmaps are drawn from their bits by the simple inks, the
+	//others get them unpacked once for the frame
+	bool packed = item.packed && (ink == kInkTypeCopy || ink == kInkTypeBackgndTrans || ink == kInkTypeMatte);
+
+	if (item.packed && !packed && !item.image) {
+		item.expanded = unpackBitmap(*item.packed);
+		item.image = item.expanded;
+	}
+
+	int width = packed ? item.packed->width : item.image->w;
+	int height = packed ? item.packed->height : item.image->h;
+
+	//Clip once against the region and the decoded image, so the ink loops
+	//below can walk srcRect without checking any bounds
+	Common::Rect dstRect(drawRect.left, drawRect.top, drawRect.left + MIN<int>(drawRect.width(), width), drawRect.top + MIN<int>(drawRect.height(), height));
+	dstRect.clip(clip);
+
+	if (dstRect.isEmpty())
+		return;
+
+	Common::Rect srcRect(dstRect.width(), dstRect.height());
+	srcRect.translate(dstRect.left - drawRect.left, dstRect.top - drawRect.top);
+	Common::Point dstPos(dstRect.left, dstRect.top);
+
+	if (packed) {
+		drawPackedSprite(target, *item.packed, srcRect, dstPos, ink);
+		return;
+	}
+
+	const Graphics::Surface &sprite = *item.image;
+
+	switch (ink) {
+	case kInkTypeCopy:
+		target.blitFrom(sprite, srcRect, dstPos);
 		break;
-	case kTypeButton:
-		surface.frameRect(Common::Rect(x, y, x + width, y + height), 0);
+	case kInkTypeBackgndTrans:
+		drawBackgndTransSprite(target, sprite, srcRect, dstPos);
+		break;
+	case kInkTypeMatte:
+		//The fill has to see the whole image, so it is done once per sprite
+		if (!item.matteMask)
+			item.matteMask = createMatteMask(sprite);
+
+		drawMatteSprite(target, sprite, *item.matteMask, srcRect, dstPos);
+		break;
+	case kInkTypeGhost:
+		drawGhostSprite(target, sprite, srcRect, dstPos);
+		break;
+	case kInkTypeReverse:
+		drawReverseSprite(target, sprite, srcRect, dstPos);
+		break;
+	case kInkTypeBlend:
+	case kInkTypeAddPin:
+	case kInkTypeAdd:
+	case kInkTypeSubPin:
+	case kInkTypeLight:
+	case kInkTypeSub:
+	case kInkTypeDark:
+		drawBlendSprite(target, sprite, srcRect, dstPos, _vm->_currentScore->_blendTables->getTable(_vm->getPaletteVersion(), _vm->getPalette(), _vm->getPaletteColorCount(), ink, _blend));
+		break;
+	default:
+		warning("Unhandled ink type %d", ink);
+		target.blitFrom(sprite, srcRect, dstPos);
 		break;
 	}
 }
 
-Image::ImageDecoder *Frame::getImageFrom(uint16 spriteId) {
+void Frame::markCoverage(const Common::Rect &drawRect, uint16 spriteId) {
+	Graphics::Surface *coverage = _vm->_currentScore->_coverageSurface;
+	Common::Rect r = drawRect;
+
+	r.clip(Common::Rect(coverage->w, coverage->h));
+
+	if (r.isEmpty())
+		return;
+
+	for (int ii = r.top; ii < r.bottom; ii++)
+		memset(coverage->getBasePtr(r.left, ii), spriteId + 1, r.width());
+}
+
+Image::ImageDecoder *Frame::getImageFrom(uint16 spriteId, BitmapCast *bitmap) {
 	uint16 imgId = spriteId + 1024;
 	Image::ImageDecoder *img = NULL;
 
 	if (_vm->_currentScore->getArchive()->hasResource(MKTAG('D', 'I', 'B', ' '), imgId)) {
-		img = new DIBDecoder();
+		img = new DIBDecoder(_vm->getSurfacePool(), _vm->getDIBCodecs());
 		img->loadStream(*_vm->_currentScore->getArchive()->getResource(MKTAG('D', 'I', 'B', ' '), imgId));
 		return img;
 	}
 
 	if (_vm->getSharedDIB()->contains(imgId)) {
-		img = new DIBDecoder();
+		img = new DIBDecoder(_vm->getSurfacePool(), _vm->getDIBCodecs());
 		img->loadStream(*_vm->getSharedDIB()->getVal(imgId));
 		return img;
 	}
 
-	if (_vm->_currentScore->getArchive()->hasResource(MKTAG('B', 'I', 'T', 'D'), imgId)) {
-		img = new Image::BitmapDecoder();
-		img->loadStream(*_vm->_currentScore->getArchive()->getResource(MKTAG('B', 'I', 'T', 'D'), imgId));
-		return img;
-	}
+	uint16 width = bitmap->boundingRect.width();
+	uint16 height = bitmap->boundingRect.height();
 
-	if (_vm->getSharedBMP()->contains(imgId)) {
-		img = new Image::BitmapDecoder();
-		img->loadStream(*_vm->getSharedBMP()->getVal(imgId));
-		return img;
+	Common::SeekableSubReadStreamEndian *bitdStream = nullptr;
+
+	if (_vm->_currentScore->getArchive()->hasResource(MKTAG('B', 'I', 'T', 'D'), imgId))
+		bitdStream = _vm->_currentScore->getArchive()->getResource(MKTAG('B', 'I', 'T', 'D'), imgId);
+	else if (_vm->getSharedBMP()->contains(imgId))
+		bitdStream = _vm->getSharedBMP()->getVal(imgId);
+
+	if (bitdStream) {
+		BITDDecoder *bitd = new BITDDecoder(width, height, _vm->getSurfacePool(), _vm->getCastExpanders());
+		bitd->loadStream(*bitdStream);
+
+		//Monochrome casts stay resident, at an eighth of their 8-bit size
+		if (_vm->_currentScore->isPackingBitmaps() && bitd->getBitsPerPixel() == 1 && bitd->getSurface() && !bitmap->packed)
+			bitmap->packed = new PackedBitmap(*bitd->getSurface());
+
+		return bitd;
 	}
 
 	warning("Image %d not found", spriteId);
@@ -1400,16 +1958,127 @@ Image::ImageDecoder *Frame::getImageFrom(uint16 spriteId) {
 }
 
 
-void Frame::renderText(Graphics::ManagedSurface &surface, uint16 spriteID) {
+const TextCacheEntry *Frame::prepareText(uint16 spriteID, TextCast *textCast, Common::Rect &rect) {
+	ScopedPhaseTimer timer(_vm->getProfiler(), kPhaseText);
 	uint16 castID = _sprites[spriteID]->_castId;
 
-	TextCast *textCast = static_cast<TextCast *>(_vm->_currentScore->_casts[castID]);
+	uint32 rectLeft = textCast->initialRect.left;
+	uint32 rectTop = textCast->initialRect.top;
+
+	int x = _sprites[spriteID]->_startPoint.x + rectLeft;
+	int y = _sprites[spriteID]->_startPoint.y + rectTop;
+	int height = _sprites[spriteID]->_height;
+	int width = _sprites[spriteID]->_width;
+
+	if (!textCast->textLoaded)
+		loadText(textCast, castID);
+
+	uint32 key = textCast->textHash;
+	key = key * 31 + textCast->fontId;
+	key = key * 31 + textCast->fontSize;
+	key = key * 31 + width;
+	key = key * 31 + height;
+	key = key * 31 + textCast->version;
+
+	//Every sprite gets the text at its own box size, the items of a frame
+	//are all prepared before any of them is drawn
+	Common::Array<TextCacheEntry *> &cache = textCast->cache;
+	TextCacheEntry *entry = nullptr;
+
+	for (uint i = 0; i < cache.size(); i++) {
+		if (cache[i]->version != textCast->version) {
+			cache[i]->surface.free();
+			delete cache[i];
+			cache.remove_at(i--);
+		} else if (cache[i]->key == key) {
+			entry = cache[i];
+			cache.remove_at(i);
+			break;
+		}
+	}
+
+	if (!entry) {
+		if (!textCast->font)
+			_vm->_currentScore->resolveFont(textCast);
+
+		//Text can run below the box, and borders and frames stick out of it
+		//(drawn with the box sides swapped), so leave room for all of that
+		int textHeight = _vm->_currentScore->getGlyphAtlas(textCast->font)->getLayout(textCast->text, width)->lines.size() * textCast->font->getFontHeight();
+		int contentWidth = width;
+		int contentHeight = MAX(height, textHeight);
+
+		if (textCast->borderSize != kSizeNone || textCast->gutterSize != kSizeNone) {
+			contentWidth = MAX(contentWidth, height);
+			contentHeight = MAX(contentHeight, width);
+		}
+
+		int extentWidth = contentWidth + 2 * kTextCacheMargin;
+		int extentHeight = contentHeight + 2 * kTextCacheMargin;
+
+		if (cache.size() >= kTextCachedSizes) {
+			entry = cache[0];
+			cache.remove_at(0);
+		} else {
+			entry = new TextCacheEntry;
+		}
+
+		entry->surface.create(extentWidth, extentHeight);
+		entry->surface.clear(kTextCacheKeyColor);
+
+		if (textCast->type == kCastButton)
+			entry->rect = drawButton(entry->surface, static_cast<ButtonCast *>(textCast), kTextCacheMargin, kTextCacheMargin, width, height);
+		else
+			entry->rect = drawText(entry->surface, textCast, kTextCacheMargin, kTextCacheMargin, width, height);
+
+		entry->rect.clip(Common::Rect(extentWidth, extentHeight));
+		entry->key = key;
+		entry->version = textCast->version;
+	}
+
+	cache.push_back(entry);
+
+	rect = entry->rect;
+	rect.translate(x - kTextCacheMargin, y - kTextCacheMargin);
+
+	return entry;
+}
+
+void Frame::drawCachedText(Graphics::ManagedSurface &surface, const RenderItem &item, const Common::Rect &clip) {
+	ScopedPhaseTimer timer(_vm->getProfiler(), kPhaseText);
+	const TextCacheEntry *entry = item.text;
+	Common::Rect dst = item.rect;
+	dst.clip(clip);
+
+	if (!entry || dst.isEmpty())
+		return;
+
+	Common::Rect src(dst.width(), dst.height());
+	src.translate(entry->rect.left + dst.left - item.rect.left, entry->rect.top + dst.top - item.rect.top);
+
+	surface.transBlitFrom(entry->surface, src, Common::Point(dst.left, dst.top), kTextCacheKeyColor);
+}
+
+void Frame::drawFilmLoop(Graphics::ManagedSurface &surface, const RenderItem &item, const Common::Rect &clip) {
+	FilmLoopCast *loop = static_cast<FilmLoopCast *>(item.cast);
+	Common::Rect dst = item.rect;
+	dst.clip(clip);
+
+	if (dst.isEmpty())
+		return;
+
+	Common::Rect src(dst.width(), dst.height());
+	src.translate(dst.left - item.rect.left, dst.top - item.rect.top);
+
+	surface.transBlitFrom(*item.image, src, Common::Point(dst.left, dst.top), loop->keyColor);
+}
+
+void Frame::loadText(TextCast *textCast, uint16 castID) {
 	Common::SeekableSubReadStreamEndian *textStream;
 
 	if (_vm->_currentScore->_movieArchive->hasResource(MKTAG('S','T','X','T'), castID + 1024)) {
 		textStream = _vm->_currentScore->_movieArchive->getResource(MKTAG('S','T','X','T'), castID + 1024);
 	} else {
-		textStream = _vm->getSharedSTXT()->getVal(spriteID + 1024);
+		textStream = _vm->getSharedSTXT()->getVal(castID + 1024);
 	}
 	/*uint32 unk1 = */ textStream->readUint32();
 	uint32 strLen = textStream->readUint32();
@@ -1424,21 +2093,18 @@ void Frame::renderText(Graphics::ManagedSurface &surface, uint16 spriteID) {
 		text += ch;
 	}
 
-	uint32 rectLeft = static_cast<TextCast *>(_sprites[spriteID]->_cast)->initialRect.left;
-	uint32 rectTop = static_cast<TextCast *>(_sprites[spriteID]->_cast)->initialRect.top;
-
-	int x = _sprites[spriteID]->_startPoint.x + rectLeft;
-	int y = _sprites[spriteID]->_startPoint.y + rectTop;
-	int height = _sprites[spriteID]->_height;
-	int width = _sprites[spriteID]->_width;
+	textCast->setText(text);
+}
 
-	const Graphics::Font *font = FontMan.getFontByName(_vm->_currentScore->_fontMap[textCast->fontId]);
+Common::Rect Frame::drawText(Graphics::ManagedSurface &surface, TextCast *textCast, int x, int y, int width, int height) {
+	//Shared casts are not resolved with the movie ones
+	if (!textCast->font)
+		_vm->_currentScore->resolveFont(textCast);
 
-	if (!font) {
-		error("Cannot load font %s", _vm->_currentScore->_fontMap[textCast->fontId].c_str());
-	}
+	Common::Rect textRect = _vm->_currentScore->getGlyphAtlas(textCast->font)->drawText(&surface.rawSurface(), textCast->text, x, y, width, 0);
 
-	font->drawString(&surface, text, x, y, width, 0);
+	//Everything touched below, so the caller can restore it later
+	Common::Rect bbox(x, y, x + width, y + MAX<int>(height, textRect.height()));
 
 	if (textCast->borderSize != kSizeNone) {
 		uint16 size = textCast->borderSize;
@@ -1452,6 +2118,7 @@ void Frame::renderText(Graphics::ManagedSurface &surface, uint16 spriteID) {
 
 		while (size) {
 			surface.frameRect(Common::Rect(x, y, x + height, y + width), 0);
+			bbox.extend(Common::Rect(x, y, x + height, y + width));
 			x--;
 			y--;
 			height += 2;
@@ -1469,25 +2136,47 @@ void Frame::renderText(Graphics::ManagedSurface &surface, uint16 spriteID) {
 		uint16 size = textCast->gutterSize;
 
 		surface.frameRect(Common::Rect(x, y, x + height, y + width), 0);
+		bbox.extend(Common::Rect(x, y, x + height, y + width));
 
 		while (size) {
 			surface.drawLine(x + width, y, x + width, y + height, 0);
 			surface.drawLine(x, y + height, x + width, y + height, 0);
+			bbox.extend(Common::Rect(x, y, x + width + 1, y + height + 1));
 			x++;
 			y++;
 			size--;
 		}
 	}
+
+	return bbox;
 }
 
-void Frame::drawBackgndTransSprite(Graphics::ManagedSurface &target, const Graphics::Surface &sprite, Common::Rect &drawRect) {
+Common::Rect Frame::drawButton(Graphics::ManagedSurface &surface, ButtonCast *button, int x, int y, int width, int height) {
+	Common::Rect bbox = drawText(surface, button, x, y, width, height);
+
+	switch (button->buttonType) {
+	case kTypeCheckBox:
+		//Magic numbers: checkbox square need to move left about 5px from text and 12px side size (d4)
+		surface.frameRect(Common::Rect(x - 17, y, x + 12, y + 12), 0);
+		bbox.extend(Common::Rect(x - 17, y, x + 12, y + 12));
+		break;
+	case kTypeButton:
+		surface.frameRect(Common::Rect(x, y, x + width, y + height), 0);
+		bbox.extend(Common::Rect(x, y, x + width, y + height));
+		break;
+	}
+
+	return bbox;
+}
+
+void Frame::drawBackgndTransSprite(Graphics::ManagedSurface &target, const Graphics::Surface &sprite, const Common::Rect &srcRect, const Common::Point &dstPos) {
 	uint8 skipColor = _vm->getPaletteColorCount() - 1; //FIXME is it always white (last entry in pallette) ?
 
-	for (int ii = 0; ii < sprite.h; ii++) {
-		const byte *src = (const byte *)sprite.getBasePtr(0, ii);
-		byte *dst = (byte *)target.getBasePtr(drawRect.left, drawRect.top + ii);
+	for (int ii = 0; ii < srcRect.height(); ii++) {
+		const byte *src = (const byte *)sprite.getBasePtr(srcRect.left, srcRect.top + ii);
+		byte *dst = (byte *)target.getBasePtr(dstPos.x, dstPos.y + ii);
 
-		for (int j = 0; j < drawRect.width(); j++) {
+		for (int j = 0; j < srcRect.width(); j++) {
 			if (*src != skipColor)
 				*dst = *src;
 
@@ -1497,40 +2186,52 @@ void Frame::drawBackgndTransSprite(Graphics::ManagedSurface &target, const Graph
 	}
 }
 
-void Frame::drawGhostSprite(Graphics::ManagedSurface &target, const Graphics::Surface &sprite, Common::Rect &drawRect) {
+void Frame::drawGhostSprite(Graphics::ManagedSurface &target, const Graphics::Surface &sprite, const Common::Rect &srcRect, const Common::Point &dstPos) {
 	uint8 skipColor = _vm->getPaletteColorCount() - 1;
-	for (int ii = 0; ii < sprite.h; ii++) {
-		const byte *src = (const byte *)sprite.getBasePtr(0, ii);
-		byte *dst = (byte *)target.getBasePtr(drawRect.left, drawRect.top + ii);
+	const Graphics::Surface *coverage = _vm->_currentScore->_coverageSurface;
+
+	for (int ii = 0; ii < srcRect.height(); ii++) {
+		const byte *src = (const byte *)sprite.getBasePtr(srcRect.left, srcRect.top + ii);
+		const byte *cov = (const byte *)coverage->getBasePtr(dstPos.x, dstPos.y + ii);
+		byte *dst = (byte *)target.getBasePtr(dstPos.x, dstPos.y + ii);
 
-		for (int j = 0; j < drawRect.width(); j++) {
-			if ((getSpriteIDFromPos(Common::Point(drawRect.left + j, drawRect.top + ii)) != 0) && (*src != skipColor))
+		for (int j = 0; j < srcRect.width(); j++) {
+			if ((*cov != 0) && (*src != skipColor))
 				*dst = (_vm->getPaletteColorCount() - 1) - *src; //Oposite color
 
 			src++;
+			cov++;
 			dst++;
 		}
 	}
 }
 
-void Frame::drawReverseSprite(Graphics::ManagedSurface &target, const Graphics::Surface &sprite, Common::Rect &drawRect) {
+void Frame::drawReverseSprite(Graphics::ManagedSurface &target, const Graphics::Surface &sprite, const Common::Rect &srcRect, const Common::Point &dstPos) {
 	uint8 skipColor = _vm->getPaletteColorCount() - 1;
-	for (int ii = 0; ii < sprite.h; ii++) {
-		const byte *src = (const byte *)sprite.getBasePtr(0, ii);
-		byte *dst = (byte *)target.getBasePtr(drawRect.left, drawRect.top + ii);
+	const Graphics::Surface *coverage = _vm->_currentScore->_coverageSurface;
 
-		for (int j = 0; j < drawRect.width(); j++) {
-			if ((getSpriteIDFromPos(Common::Point(drawRect.left + j, drawRect.top + ii)) != 0))
+	for (int ii = 0; ii < srcRect.height(); ii++) {
+		const byte *src = (const byte *)sprite.getBasePtr(srcRect.left, srcRect.top + ii);
+		const byte *cov = (const byte *)coverage->getBasePtr(dstPos.x, dstPos.y + ii);
+		byte *dst = (byte *)target.getBasePtr(dstPos.x, dstPos.y + ii);
+
+		for (int j = 0; j < srcRect.width(); j++) {
+			if (*cov != 0)
 				*dst = (_vm->getPaletteColorCount() - 1) - *src;
 			else if (*src != skipColor)
 				*dst = *src;
 			src++;
+			cov++;
 			dst++;
 		}
 	}
 }
 
-void Frame::drawMatteSprite(Graphics::ManagedSurface &target, const Graphics::Surface &sprite, Common::Rect &drawRect) {
+void Frame::drawBlendSprite(Graphics::ManagedSurface &target, const Graphics::Surface &sprite, const Common::Rect &srcRect, const Common::Point &dstPos, const byte *table) {
+	blendBlit(target.rawSurface(), sprite, srcRect, dstPos, table);
+}
+
+Graphics::Surface *Frame::createMatteMask(const Graphics::Surface &sprite) {
 	//Like background trans, but all white pixels NOT ENCLOSED by coloured pixels are transparent
 	Graphics::Surface tmp;
 	tmp.copyFrom(sprite);
@@ -1570,23 +2271,65 @@ void Frame::drawMatteSprite(Graphics::ManagedSurface &target, const Graphics::Su
 	}
 	ff.fillMask();
 
-	for (int yy = 0; yy < tmp.h; yy++) {
-		const byte *src = (const byte *)tmp.getBasePtr(0, yy);
-		const byte *mask = (const byte *)ff.getMask()->getBasePtr(0, yy);
-		byte *dst = (byte *)target.getBasePtr(drawRect.left, drawRect.top + yy);
+	Graphics::Surface *mask = new Graphics::Surface;
+	mask->copyFrom(*ff.getMask());
+
+	tmp.free();
 
-		for (int xx = 0; xx < drawRect.width(); xx++, src++, dst++, mask++)
+	return mask;
+}
+
+void Frame::drawMatteSprite(Graphics::ManagedSurface &target, const Graphics::Surface &sprite, const Graphics::Surface &matteMask, const Common::Rect &srcRect, const Common::Point &dstPos) {
+	for (int yy = 0; yy < srcRect.height(); yy++) {
+		const byte *src = (const byte *)sprite.getBasePtr(srcRect.left, srcRect.top + yy);
+		const byte *mask = (const byte *)matteMask.getBasePtr(srcRect.left, srcRect.top + yy);
+		byte *dst = (byte *)target.getBasePtr(dstPos.x, dstPos.y + yy);
+
+		for (int xx = 0; xx < srcRect.width(); xx++, src++, dst++, mask++)
 			if (*mask == 0)
 				*dst = *src;
 	}
+}
 
-	tmp.free();
+void Frame::resetHitIndex(const Common::Rect &stage) {
+	for (uint16 i = 0; i < CHANNEL_COUNT; i++)
+		_spriteBounds[i] = Common::Rect();
+
+	memset(_hitGrid, 0, sizeof(_hitGrid));
+
+	_hitStage = stage;
+	_hitCellWidth = (stage.width() + HITTEST_GRID_SIZE - 1) / HITTEST_GRID_SIZE;
+	_hitCellHeight = (stage.height() + HITTEST_GRID_SIZE - 1) / HITTEST_GRID_SIZE;
+}
+
+void Frame::addHitRect(const Common::Rect &drawRect, uint16 spriteId) {
+	Common::Rect r = drawRect;
+	r.clip(_hitStage);
+
+	if (r.isEmpty() || spriteId >= CHANNEL_COUNT)
+		return;
+
+	_spriteBounds[spriteId] = r;
+
+	uint16 left = r.left / _hitCellWidth;
+	uint16 right = (r.right - 1) / _hitCellWidth;
+	uint16 top = r.top / _hitCellHeight;
+	uint16 bottom = (r.bottom - 1) / _hitCellHeight;
+
+	for (uint16 y = top; y <= bottom; y++)
+		for (uint16 x = left; x <= right; x++)
+			_hitGrid[y * HITTEST_GRID_SIZE + x] |= 1 << spriteId;
 }
 
 uint16 Frame::getSpriteIDFromPos(Common::Point pos) {
+	if (!_hitStage.contains(pos))
+		return 0;
+
+	uint32 mask = _hitGrid[(pos.y / _hitCellHeight) * HITTEST_GRID_SIZE + pos.x / _hitCellWidth];
+
 	//Find first from top to bottom
-	for (uint16 i = _drawRects.size() - 1; i > 0; i--) {
-		if (_drawRects[i].contains(pos))
+	for (uint16 i = CHANNEL_COUNT - 1; i > 0; i--) {
+		if ((mask & (1 << i)) && _spriteBounds[i].contains(pos))
 			return i;
 	}
 
@@ -1604,6 +2347,7 @@ Sprite::Sprite() {
 	_constraint = 0;
 	_moveable = 0;
 	_castId = 0;
+	_cast = nullptr;
 }
 
 Sprite::Sprite(const Sprite &sprite) {
@@ -1616,11 +2360,11 @@ Sprite::Sprite(const Sprite &sprite) {
 	_height = sprite._height;
 	_startPoint.x = sprite._startPoint.x;
 	_startPoint.y = sprite._startPoint.y;
+	_cast = sprite._cast;
 }
 
 Sprite::~Sprite() {
-	delete _cast;
-	delete &_startPoint;
+	//Casts belong to the score or the shared cast, not to the sprites
 }
 
 } //End of namespace Director
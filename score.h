@@ -37,9 +37,19 @@ namespace Director {
 class Lingo;
 class DirectorSound;
 class Score;
+class Frame;
 class DirectorEngine;
+class GlyphAtlas;
+class BlendTableCache;
 
 #define CHANNEL_COUNT 24
+#define HITTEST_GRID_SIZE 16
+
+enum {
+	kTextCacheMargin = 20,
+	kTextCachedSizes = 2 * CHANNEL_COUNT, // per cast, as for shapes
+	kTextCacheKeyColor = 0xff // text and frames are always drawn with color 0
+};
 
 enum CastType {
 	kCastBitmap = 1,
@@ -168,18 +178,38 @@ enum TransitionType {
 };
 
 struct Cast {
+	Cast() : modified(0), version(0) {}
+	virtual ~Cast() {}
+
 	CastType type;
 	Common::Rect initialRect;
 	byte modified;
+	uint32 version; // bumped on every change, so caches of the cast can tell
+};
+
+// A 1-bit cast bitmap kept in memory as decoded, a bit per pixel. Set
+// bits are black, index 0, clear bits white, the last palette entry.
+struct PackedBitmap {
+	PackedBitmap(const Graphics::Surface &surface);
+	~PackedBitmap();
+
+	uint16 width;
+	uint16 height;
+	uint16 rowBytes;
+	byte *bits;
+	byte *matte; // set where the matte ink leaves the stage, built on first use
 };
 
 struct BitmapCast : Cast {
 	BitmapCast(Common::SeekableSubReadStreamEndian &stream);
+	~BitmapCast();
 
 	Common::Rect boundingRect;
 	uint16 regX;
 	uint16 regY;
 	uint8 flags;
+
+	PackedBitmap *packed; // 1-bit bitmaps, once decoded
 };
 
 enum ShapeType {
@@ -189,8 +219,29 @@ enum ShapeType {
 	kShapeLine
 };
 
+struct ShapeSpan {
+	int16 y;
+	int16 left;
+	int16 right;
+};
+
+// Rasterized shape, fill and frame spans relative to the sprite box
+struct ShapeSpans {
+	int width;
+	int height;
+	ShapeType shapeType;
+	byte lineThickness;
+	byte lineDirection;
+	Common::Array<ShapeSpan> fill; // one per row
+	Common::Array<ShapeSpan> outline;
+};
+
 struct ShapeCast : Cast {
 	ShapeCast(Common::SeekableSubReadStreamEndian &stream);
+	~ShapeCast();
+
+	// 8x8 fill pattern for a Director pattern id, nullptr past the system ones
+	static const byte *getPattern(uint16 id);
 
 	ShapeType shapeType;
 	uint16 pattern;
@@ -199,6 +250,29 @@ struct ShapeCast : Cast {
 	byte fillType;
 	byte lineThickness;
 	byte lineDirection;
+
+	//Rasterized for the last few sprite sizes, most recently used last
+	Common::Array<ShapeSpans *> spans;
+};
+
+// A movie in a cast member, its frames are composited once and replayed
+struct FilmLoopCast : Cast {
+	FilmLoopCast(Common::SeekableSubReadStreamEndian &stream);
+	~FilmLoopCast();
+
+	Common::Array<Frame *> frames;
+
+	//One surface per frame, the part of the loop on the stage, built on
+	//first display
+	Common::Array<Graphics::Surface *> cache;
+	Common::Point cacheOffset; // of the cached part within initialRect
+	byte keyColor; // marks pixels no sprite of the loop covers
+
+	//Every channel plays the loop on its own
+	uint16 currentFrame[CHANNEL_COUNT];
+	uint32 lastShown[CHANNEL_COUNT]; // score frame + 1 that showed it, 0 if never
+	bool cacheBuilt;
+	bool building;
 };
 
 enum TextType {
@@ -228,8 +302,19 @@ enum SizeType {
 	kSizeLargest
 };
 
+// Text of a cast pre-rendered at one box size
+struct TextCacheEntry {
+	uint32 key; // text, font and box it was rendered with
+	uint32 version; // of the cast, older ones are dropped
+	Graphics::ManagedSurface surface;
+	Common::Rect rect; // area drawn into, the box is at kTextCacheMargin
+};
+
 struct TextCast : Cast {
 	TextCast(Common::SeekableSubReadStreamEndian &stream);
+	~TextCast();
+
+	void setText(const Common::String &str);
 
 	SizeType borderSize;
 	SizeType gutterSize;
@@ -237,10 +322,18 @@ struct TextCast : Cast {
 
 	uint32 fontId;
 	uint16 fontSize;
+	const Graphics::Font *font; // resolved from fontId when the movie is loaded
 	TextType textType;
 	TextAlignType textAlign;
 	SizeType textShadow;
 	Common::Array<TextFlag> textFlags;
+
+	Common::String text;
+	bool textLoaded;
+	uint32 textHash;
+
+	//Pre-rendered for the last few box sizes, most recently used last
+	Common::Array<TextCacheEntry *> cache;
 };
 
 enum ButtonType {
@@ -265,7 +358,17 @@ struct CastInfo {
 	Common::String type;
 };
 
+// PaletteInfo flags
+enum {
+	kPaletteCycle = 0x80,
+	kPaletteFadeMask = 0x60,
+	kPaletteFadeToWhite = 0x40,
+	kPaletteFadeToBlack = 0x60,
+	kPaletteAutoReverse = 0x10
+};
+
 struct PaletteInfo {
+	uint16 paletteId; // 0 when the frame has no palette channel
 	uint8 firstColor;
 	uint8 lastColor;
 	uint8 flags;
@@ -293,29 +396,74 @@ public:
 	byte _moveable;
 };
 
+// A sprite of the frame with its cast resolved and its image decoded,
+// ready to be composited into any part of the stage
+struct RenderItem {
+	uint16 spriteId;
+	Cast *cast;
+	Common::Rect rect; // stage area it covers
+	Image::ImageDecoder *decoder; // bitmaps only
+	const Graphics::Surface *image;
+	Graphics::Surface *matteMask; // built on first use by the matte ink
+	PackedBitmap *packed; // resident 1-bit bitmap, instead of a decoder
+	Graphics::Surface *expanded; // packed bitmap unpacked for the other inks
+	const ShapeSpans *spans; // shapes only, rasterized at this sprite's size
+	const TextCacheEntry *text; // text and buttons, rendered at this sprite's size
+};
+
+enum CompositeMode {
+	kCompositeSerial,
+	kCompositeTiled, // in horizontal bands, one at a time
+	kCompositeCompare // serial, then every band count on a copy, checked and timed
+};
+
 class Frame {
 public:
 	Frame(DirectorEngine *vm);
 	Frame(const Frame &frame);
 	~Frame();
 	void readChannel(Common::SeekableSubReadStreamEndian &stream, uint16 offset, uint16 size);
-	void prepareFrame(Score *score);
+	bool prepareFrame(Score *score, bool present);
+	void composite(Graphics::ManagedSurface &surface, const Common::Rect &clip);
 	uint16 getSpriteIDFromPos(Common::Point pos);
 
 private:
 	void playTransition(Score *score);
 	void playSoundChannel();
-	void renderSprites(Graphics::ManagedSurface &surface, bool renderTrail);
-	void renderText(Graphics::ManagedSurface &surface, uint16 spriteId);
-	void renderButton(Graphics::ManagedSurface &surface, uint16 spriteId);
+	void renderSprites(Graphics::ManagedSurface &surface, Graphics::ManagedSurface &trailSurface, Common::Array<RenderItem> &items);
+	void buildRenderList(Common::Array<RenderItem> &items, const Common::Rect &stage);
+	void decodeRenderList(Common::Array<RenderItem> &items);
+	uint32 hashRenderList(const Common::Array<RenderItem> &items);
+	void compositeRegion(Graphics::ManagedSurface &surface, Graphics::ManagedSurface *trailSurface, Common::Array<RenderItem> &items, const Common::Array<Common::Rect> &restoreRects, const Common::Rect &clip);
+	void compositeTiles(Graphics::ManagedSurface &surface, Graphics::ManagedSurface &trailSurface, Common::Array<RenderItem> &items, const Common::Array<Common::Rect> &restoreRects, uint16 tiles);
+	void compareComposite(Graphics::ManagedSurface &surface, Graphics::ManagedSurface &trailSurface, Common::Array<RenderItem> &items, const Common::Array<Common::Rect> &restoreRects, uint16 maxTiles);
+	const TextCacheEntry *prepareText(uint16 spriteId, TextCast *textCast, Common::Rect &rect);
+	void drawCachedText(Graphics::ManagedSurface &surface, const RenderItem &item, const Common::Rect &clip);
+	void drawFilmLoop(Graphics::ManagedSurface &surface, const RenderItem &item, const Common::Rect &clip);
+	void freeRenderList(Common::Array<RenderItem> &items);
+	void loadText(TextCast *textCast, uint16 castId);
+	Common::Rect drawText(Graphics::ManagedSurface &surface, TextCast *textCast, int x, int y, int width, int height);
+	Common::Rect drawButton(Graphics::ManagedSurface &surface, ButtonCast *button, int x, int y, int width, int height);
+	const ShapeSpans *prepareShape(uint16 spriteId, ShapeCast *shape, Common::Rect &rect);
+	void drawShape(Graphics::ManagedSurface &surface, const RenderItem &item, const Common::Rect &clip);
+	void rasterizeShape(ShapeSpans *spans, const ShapeCast *shape, int width, int height);
 	void readPaletteInfo(Common::SeekableSubReadStreamEndian &stream);
 	void readSprite(Common::SeekableSubReadStreamEndian &stream, uint16 offset, uint16 size);
 	void readMainChannels(Common::SeekableSubReadStreamEndian &stream, uint16 offset, uint16 size);
-	Image::ImageDecoder *getImageFrom(uint16 spriteID);
-	void drawBackgndTransSprite(Graphics::ManagedSurface &target, const Graphics::Surface &sprite, Common::Rect &drawRect);
-	void drawMatteSprite(Graphics::ManagedSurface &target, const Graphics::Surface &sprite, Common::Rect &drawRect);
-	void drawGhostSprite(Graphics::ManagedSurface &target, const Graphics::Surface &sprite, Common::Rect &drawRect);
-	void drawReverseSprite(Graphics::ManagedSurface &target, const Graphics::Surface &sprite, Common::Rect &drawRect);
+	Image::ImageDecoder *getImageFrom(uint16 spriteID, BitmapCast *bitmap);
+	void drawSprite(Graphics::ManagedSurface &target, RenderItem &item, const Common::Rect &clip);
+	void drawBackgndTransSprite(Graphics::ManagedSurface &target, const Graphics::Surface &sprite, const Common::Rect &srcRect, const Common::Point &dstPos);
+	Graphics::Surface *createMatteMask(const Graphics::Surface &sprite);
+	void drawMatteSprite(Graphics::ManagedSurface &target, const Graphics::Surface &sprite, const Graphics::Surface &matteMask, const Common::Rect &srcRect, const Common::Point &dstPos);
+	void drawGhostSprite(Graphics::ManagedSurface &target, const Graphics::Surface &sprite, const Common::Rect &srcRect, const Common::Point &dstPos);
+	void drawReverseSprite(Graphics::ManagedSurface &target, const Graphics::Surface &sprite, const Common::Rect &srcRect, const Common::Point &dstPos);
+	void drawPackedSprite(Graphics::ManagedSurface &target, PackedBitmap &packed, const Common::Rect &srcRect, const Common::Point &dstPos, InkType ink);
+	Graphics::Surface *unpackBitmap(const PackedBitmap &packed);
+	void buildPackedMatte(PackedBitmap &packed);
+	void drawBlendSprite(Graphics::ManagedSurface &target, const Graphics::Surface &sprite, const Common::Rect &srcRect, const Common::Point &dstPos, const byte *table);
+	void markCoverage(const Common::Rect &drawRect, uint16 spriteId);
+	void resetHitIndex(const Common::Rect &stage);
+	void addHitRect(const Common::Rect &drawRect, uint16 spriteId);
 public:
 	uint8 _actionId;
 	uint8 _transDuration;
@@ -333,8 +481,57 @@ public:
 	uint8 _skipFrameFlag;
 	uint8 _blend;
 	Common::Array<Sprite *> _sprites;
-	Common::Array<Common::Rect > _drawRects;
 	DirectorEngine *_vm;
+
+private:
+	// Hit test index, rebuilt on every render. Each grid cell keeps a mask
+	// of the channels whose bounds touch it, so lookups are bounded by
+	// CHANNEL_COUNT rect tests.
+	Common::Rect _spriteBounds[CHANNEL_COUNT];
+	uint32 _hitGrid[HITTEST_GRID_SIZE * HITTEST_GRID_SIZE];
+	Common::Rect _hitStage;
+	uint16 _hitCellWidth;
+	uint16 _hitCellHeight;
+};
+
+struct TransParams {
+	TransitionType type;
+	uint32 startTime;
+	uint32 duration;
+	uint16 steps;
+	uint16 stepsDone;
+	bool active;
+};
+
+// Cells of the stage in the order a dissolve reveals them
+struct DissolveTable {
+	uint16 width;
+	uint16 height;
+	uint16 cellWidth;
+	uint16 cellHeight;
+	uint16 cellsX;
+	uint16 cellsY;
+	Common::Array<uint32> cells; // offset of each cell's top left pixel
+	Common::Array<uint16> spanLeft; // per row of cells, revealed by the current step
+	Common::Array<uint16> spanRight;
+};
+
+struct PaletteEffect {
+	PaletteInfo info; // palette channel that started it
+	uint32 interval; // ms between steps
+	uint32 nextStep;
+	uint16 step;
+	uint16 steps; // 0 for cycling, which runs until the channel changes
+	int8 direction;
+	bool active;
+};
+
+enum TempoWait {
+	kTempoWaitNone,
+	kTempoWaitDelay,
+	kTempoWaitClick,
+	kTempoWaitSound,
+	kTempoWaitVideo
 };
 
 struct Label {
@@ -362,13 +559,48 @@ public:
 	void setCurrentFrame(uint16 frameId) { _currentFrame = frameId; }
 	Common::String getMacName() const { return _macName; }
 	Sprite *getSpriteById(uint16 id);
+	void resolveFont(TextCast *textCast);
+	GlyphAtlas *getGlyphAtlas(const Graphics::Font *font);
+	void startTransition(TransitionType type, uint32 duration, uint16 steps);
+	bool isTransitionActive() const { return _transition.active; }
+	bool isHeadless() const { return _headless; }
+	bool isTurbo() const { return _turbo; }
+	CompositeMode getCompositeMode() const { return _compositeMode; }
+	uint16 getTileCount() const { return _tileCount; }
+	bool isPackingBitmaps() const { return _packBitmaps; }
+	bool reuseStage(uint32 displayHash);
+	const Graphics::Surface *getFilmLoopFrame(FilmLoopCast *loop, uint16 channel);
 private:
 	void update();
+	void startPaletteEffect(const PaletteInfo &info);
+	void stepPaletteEffect();
+	void scheduleFrame();
+	uint32 getFrameInterval();
+	void startTempoWait(TempoWait type, uint16 channel, uint32 until);
+	bool isTempoWaitPending();
+	void endTempoWait();
+	bool isFrameLate();
+	uint32 getNextEventTime();
+	void waitForNextEvent();
+	void dumpFrame();
+	void stepTransition();
+	void drawTransitionStep(uint16 prev, uint16 cur);
+	void transCopyRect(const Graphics::ManagedSurface &src, const Common::Rect &dst, int srcX, int srcY);
+	void transRevealRect(const Common::Rect &r);
+	void transRevealRing(const Common::Rect &inner, const Common::Rect &outer);
+	void transShift(const Graphics::ManagedSurface &src, int dx, int dy);
+	void transRevealUnder(int dxPrev, int dyPrev, int dxCur, int dyCur);
+	void transRevealStrips(uint16 prev, uint16 cur, bool vertical, bool fromEnd, bool reverseOrder);
+	DissolveTable *getDissolveTable(uint16 cellWidth, uint16 cellHeight);
+	void transDissolve(uint16 prev, uint16 cur, uint16 cellWidth, uint16 cellHeight);
 	void readVersion(uint32 rid);
 	void loadConfig(Common::SeekableSubReadStreamEndian &stream);
 	void loadMacFonts();
 	void loadPalette(Common::SeekableSubReadStreamEndian &stream);
 	void loadFrames(Common::SeekableSubReadStreamEndian &stream);
+	void readFrames(Common::SeekableSubReadStreamEndian &stream, Common::Array<Frame *> &frames);
+	void loadFilmLoop(FilmLoopCast *loop, Common::SeekableSubReadStreamEndian &stream);
+	void buildFilmLoopCache(FilmLoopCast *loop);
 	void loadLabels(Common::SeekableSubReadStreamEndian &stream);
 	void loadActions(Common::SeekableSubReadStreamEndian &stream);
 	void loadCastInfo(Common::SeekableSubReadStreamEndian &stream, uint16 id);
@@ -388,6 +620,11 @@ public:
 	Common::HashMap<uint16, Common::String> _fontMap;
 	Graphics::ManagedSurface *_surface;
 	Graphics::ManagedSurface *_trailSurface;
+	Graphics::ManagedSurface *_backSurface; // previous stage, used by transitions
+	Graphics::Surface *_coverageSurface; // channel + 1 of the topmost sprite drawn at each pixel, 0 if empty
+	Common::Array<Common::Rect> _dirtyRects; // areas where _surface differs from _trailSurface
+	bool _screenChanged; // pixels or colors sent since the last updateScreen()
+	BlendTableCache *_blendTables;
 	Graphics::Font *_font;
 	Archive *_movieArchive;
 	Common::Rect _movieRect;
@@ -405,11 +642,38 @@ private:
 	uint16 _currentFrame;
 	Common::String _currentLabel;
 	uint32 _nextFrameTime;
+	uint32 _frameTimeRemainder; // microseconds past _nextFrameTime
+	bool _driftCompensation;
+	TempoWait _tempoWait;
+	uint16 _waitChannel; // sound or sprite channel for the wait
+	uint32 _waitUntil;
+	bool _frameSkipping;
+	bool _turbo;
+	uint16 _turboInterval; // present one frame in this many
+	uint32 _frameCost; // average ms to draw a frame
+	uint32 _droppedFrames;
+	uint16 _droppedRun;
+	uint16 _longestDroppedRun;
 	uint32 _flags;
 	bool _stopPlay;
 	uint16 _castArrayEnd;
 	uint16 _movieScriptCount;
 	uint16 _stageColor;
+	TransParams _transition;
+	PaletteEffect _paletteEffect;
+	PaletteInfo _lastPaletteInfo;
+	byte _effectPalette[768];
+	Common::Array<DissolveTable *> _dissolveTables;
+	Common::Array<GlyphAtlas *> _glyphAtlases;
+	bool _headless;
+	CompositeMode _compositeMode;
+	uint16 _tileCount;
+	bool _packBitmaps;
+	uint32 _stageHash; // display list the stage shows, 0 if unknown
+	uint32 _reusedFrames;
+	Common::String _frameDump;
+	Common::DumpFile *_checksumFile;
+	uint32 _renderedFrames;
 	Lingo *_lingo;
 	DirectorSound *_soundManager;
 	DirectorEngine *_vm;
@@ -0,0 +1,306 @@
+/* ScummVM - Graphic Adventure Engine
+ *
+ * ScummVM is the legal property of its developers, whose names
+ * are too numerous to list here. Please refer to the COPYRIGHT
+ * file distributed with this source distribution.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+ *
+ */
+
+#include "common/util.h"
+
+#include "director/director.h"
+#include "director/score.h"
+
+namespace Director {
+
+// Rasterized sizes kept per shape cast. A frame and a film loop being
+// built inside it use fewer, so eviction never hits spans still in use
+enum {
+	kShapeCachedSizes = 2 * CHANNEL_COUNT
+};
+
+// The 38 patterns of the System file's 'PAT#' 0 list, in order. Director
+// pattern ids count the tool palette swatches from 1, which start with
+// this list, black first. Set bits are drawn in the foreground color
+static const byte shapePatterns[][8] = {
+	{ 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff },
+	{ 0xdd, 0xff, 0x77, 0xff, 0xdd, 0xff, 0x77, 0xff },
+	{ 0xdd, 0x77, 0xdd, 0x77, 0xdd, 0x77, 0xdd, 0x77 },
+	{ 0xaa, 0xff, 0xaa, 0xff, 0xaa, 0xff, 0xaa, 0xff },
+	{ 0x55, 0xff, 0x55, 0xff, 0x55, 0xff, 0x55, 0xff },
+	{ 0xaa, 0xaa, 0xaa, 0xaa, 0xaa, 0xaa, 0xaa, 0xaa },
+	{ 0xee, 0xdd, 0xbb, 0x77, 0xee, 0xdd, 0xbb, 0x77 },
+	{ 0x88, 0x88, 0x88, 0x88, 0x88, 0x88, 0x88, 0x88 },
+	{ 0xb1, 0x30, 0x03, 0x1b, 0xd8, 0xc0, 0x0c, 0x8d },
+	{ 0x80, 0x10, 0x02, 0x20, 0x01, 0x08, 0x40, 0x04 },
+	{ 0xff, 0x88, 0x88, 0x88, 0xff, 0x88, 0x88, 0x88 },
+	{ 0xff, 0x80, 0x80, 0x80, 0xff, 0x08, 0x08, 0x08 },
+	{ 0x80, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00 },
+	{ 0x80, 0x40, 0x20, 0x00, 0x02, 0x04, 0x08, 0x00 },
+	{ 0x82, 0x44, 0x39, 0x44, 0x82, 0x01, 0x01, 0x01 },
+	{ 0xf8, 0x74, 0x22, 0x47, 0x8f, 0x17, 0x22, 0x71 },
+	{ 0x55, 0xa0, 0x40, 0x40, 0x55, 0x0a, 0x04, 0x04 },
+	{ 0x20, 0x50, 0x88, 0x88, 0x88, 0x88, 0x05, 0x02 },
+	{ 0xbf, 0x00, 0xbf, 0xbf, 0xb0, 0xb0, 0xb0, 0xb0 },
+	{ 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00 },
+	{ 0x80, 0x00, 0x08, 0x00, 0x80, 0x00, 0x08, 0x00 },
+	{ 0x88, 0x00, 0x22, 0x00, 0x88, 0x00, 0x22, 0x00 },
+	{ 0x88, 0x22, 0x88, 0x22, 0x88, 0x22, 0x88, 0x22 },
+	{ 0xaa, 0x00, 0xaa, 0x00, 0xaa, 0x00, 0xaa, 0x00 },
+	{ 0xff, 0x00, 0xff, 0x00, 0xff, 0x00, 0xff, 0x00 },
+	{ 0x11, 0x22, 0x44, 0x88, 0x11, 0x22, 0x44, 0x88 },
+	{ 0xff, 0x00, 0x00, 0x00, 0xff, 0x00, 0x00, 0x00 },
+	{ 0x01, 0x02, 0x04, 0x08, 0x10, 0x20, 0x40, 0x80 },
+	{ 0xaa, 0x00, 0x80, 0x00, 0x88, 0x00, 0x80, 0x00 },
+	{ 0xff, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80 },
+	{ 0x08, 0x1c, 0x22, 0xc1, 0x80, 0x01, 0x02, 0x04 },
+	{ 0x88, 0x14, 0x22, 0x41, 0x88, 0x00, 0xaa, 0x00 },
+	{ 0x40, 0xa0, 0x00, 0x00, 0x04, 0x0a, 0x00, 0x00 },
+	{ 0x03, 0x84, 0x48, 0x30, 0x0c, 0x02, 0x01, 0x01 },
+	{ 0x80, 0x80, 0x41, 0x3e, 0x08, 0x08, 0x14, 0xe3 },
+	{ 0x10, 0x20, 0x54, 0xaa, 0xff, 0x02, 0x04, 0x08 },
+	{ 0x77, 0x89, 0x8f, 0x8f, 0x77, 0x98, 0xf8, 0xf8 },
+	{ 0x00, 0x08, 0x14, 0x2a, 0x55, 0x2a, 0x14, 0x08 }
+};
+
+const byte *ShapeCast::getPattern(uint16 id) {
+	if (id < 1 || id > ARRAYSIZE(shapePatterns))
+		return nullptr;
+
+	return shapePatterns[id - 1];
+}
+
+// Horizontal extent of the shape inside a w x h box on row y, false if the row is empty
+static bool shapeRowExtent(ShapeType type, int w, int h, int y, int &left, int &right) {
+	if (w <= 0 || h <= 0 || y < 0 || y >= h)
+		return false;
+
+	switch (type) {
+	case kShapeRoundRect:
+		{
+			int r = MIN(MIN(w, h) / 2, 12); // QuickDraw default corner is 24x24
+			int dy = 0;
+
+			if (y < r)
+				dy = r - y;
+			else if (y >= h - r)
+				dy = y - (h - r) + 1;
+
+			int inset = 0;
+
+			if (dy) {
+				double d = (double)r * r - (double)(dy - 0.5) * (dy - 0.5);
+				inset = r - (d > 0 ? (int)sqrt(d) : 0);
+			}
+
+			left = inset;
+			right = w - inset;
+		}
+		break;
+	case kShapeOval:
+		{
+			double a = w / 2.0;
+			double b = h / 2.0;
+			double fy = (y + 0.5 - b) / b;
+			double dx = a * sqrt(MAX(0.0, 1.0 - fy * fy));
+
+			left = (int)(a - dx + 0.5);
+			right = (int)(a + dx + 0.5);
+		}
+		break;
+	case kShapeRectangle:
+	default:
+		left = 0;
+		right = w;
+		break;
+	}
+
+	return left < right;
+}
+
+void Frame::rasterizeShape(ShapeSpans *spans, const ShapeCast *shape, int width, int height) {
+	int thickness = shape->lineThickness;
+
+	spans->width = width;
+	spans->height = height;
+	spans->lineThickness = thickness;
+	spans->shapeType = shape->shapeType;
+	spans->lineDirection = shape->lineDirection;
+	spans->fill.resize(height);
+	spans->outline.clear();
+
+	for (int y = 0; y < height; y++) {
+		ShapeSpan &fill = spans->fill[y];
+		fill.y = y;
+		fill.left = fill.right = 0;
+
+		if (shape->shapeType == kShapeLine) {
+			//One span per row along the diagonal, lineDirection picks which one
+			int x0 = (int64)y * width / height;
+			int x1 = (int64)(y + 1) * width / height;
+
+			if (shape->lineDirection) {
+				int flipped = width - x1;
+				x1 = width - x0;
+				x0 = flipped;
+			}
+
+			ShapeSpan s;
+			s.y = y;
+			s.left = CLIP(x0 - thickness / 2, 0, width);
+			s.right = CLIP(MAX(x1, x0 + 1) + (thickness - 1) / 2, 0, width);
+
+			if (s.left < s.right)
+				spans->outline.push_back(s);
+
+			continue;
+		}
+
+		int left, right;
+
+		if (!shapeRowExtent(shape->shapeType, width, height, y, left, right))
+			continue;
+
+		fill.left = left;
+		fill.right = right;
+
+		if (!thickness)
+			continue;
+
+		//The frame is the shape minus the same shape shrunk by the line thickness
+		int innerLeft, innerRight;
+
+		if (shapeRowExtent(shape->shapeType, width - 2 * thickness, height - 2 * thickness, y - thickness, innerLeft, innerRight)) {
+			ShapeSpan s;
+			s.y = y;
+			s.left = left;
+			s.right = innerLeft + thickness;
+			spans->outline.push_back(s);
+
+			s.left = innerRight + thickness;
+			s.right = right;
+			spans->outline.push_back(s);
+		} else {
+			ShapeSpan s;
+			s.y = y;
+			s.left = left;
+			s.right = right;
+			spans->outline.push_back(s);
+		}
+	}
+}
+
+const ShapeSpans *Frame::prepareShape(uint16 spriteId, ShapeCast *shape, Common::Rect &rect) {
+	int x = _sprites[spriteId]->_startPoint.x;
+	int y = _sprites[spriteId]->_startPoint.y;
+	int width = _sprites[spriteId]->_width;
+	int height = _sprites[spriteId]->_height;
+
+	rect = Common::Rect(x, y, x + width, y + height);
+
+	if (width <= 0 || height <= 0)
+		return nullptr;
+
+	//Every sprite gets the spans for its own size, the items of a frame are
+	//all prepared before any of them is drawn
+	Common::Array<ShapeSpans *> &cache = shape->spans;
+
+	for (uint i = 0; i < cache.size(); i++) {
+		ShapeSpans *spans = cache[i];
+
+		if (spans->width == width && spans->height == height && spans->lineThickness == shape->lineThickness &&
+				spans->shapeType == shape->shapeType && spans->lineDirection == shape->lineDirection) {
+			cache.remove_at(i);
+			cache.push_back(spans);
+
+			return spans;
+		}
+	}
+
+	ShapeSpans *spans;
+
+	if (cache.size() >= kShapeCachedSizes) {
+		spans = cache[0];
+		cache.remove_at(0);
+	} else {
+		spans = new ShapeSpans();
+	}
+
+	rasterizeShape(spans, shape, width, height);
+	cache.push_back(spans);
+
+	return spans;
+}
+
+void Frame::drawShape(Graphics::ManagedSurface &surface, const RenderItem &item, const Common::Rect &clip) {
+	ShapeCast *shape = static_cast<ShapeCast *>(item.cast);
+	const ShapeSpans *spans = item.spans;
+	int x = item.rect.left;
+	int y = item.rect.top;
+
+	if (!spans || item.rect.isEmpty())
+		return;
+
+	byte fg = shape->fgCol;
+	byte bg = shape->bgCol;
+
+	if (shape->fillType && shape->shapeType != kShapeLine) {
+		//Unknown ids were reported when the cast was loaded
+		const byte *pattern = ShapeCast::getPattern(shape->pattern);
+
+		if (!pattern)
+			pattern = shapePatterns[0];
+
+		for (uint i = 0; i < spans->fill.size(); i++) {
+			const ShapeSpan &s = spans->fill[i];
+			int sy = y + s.y;
+
+			if (sy < clip.top || sy >= clip.bottom || s.left == s.right)
+				continue;
+
+			//Patterns are aligned to the stage, not to the sprite
+			byte bits = pattern[sy & 7];
+			byte row[8];
+
+			for (int k = 0; k < 8; k++)
+				row[k] = (bits & (0x80 >> k)) ? fg : bg;
+
+			int from = MAX<int>(x + s.left, clip.left);
+			int to = MIN<int>(x + s.right, clip.right);
+			byte *dst = (byte *)surface.getBasePtr(0, sy);
+
+			for (int sx = from; sx < to; sx++)
+				dst[sx] = row[sx & 7];
+		}
+	}
+
+	for (uint i = 0; i < spans->outline.size(); i++) {
+		const ShapeSpan &s = spans->outline[i];
+		int sy = y + s.y;
+
+		if (sy < clip.top || sy >= clip.bottom)
+			continue;
+
+		int from = MAX<int>(x + s.left, clip.left);
+		int to = MIN<int>(x + s.right, clip.right);
+
+		if (from < to)
+			memset(surface.getBasePtr(from, sy), fg, to - from);
+	}
+}
+
+} // End of namespace Director
@@ -0,0 +1,95 @@
+/* ScummVM - Graphic Adventure Engine
+ *
+ * ScummVM is the legal property of its developers, whose names
+ * are too numerous to list here. Please refer to the COPYRIGHT
+ * file distributed with this source distribution.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+ *
+ */
+
+#include "common/util.h"
+#include "graphics/pixelformat.h"
+
+#include "director/surfacepool.h"
+
+namespace Director {
+
+SurfacePool::SurfacePool() {
+}
+
+SurfacePool::~SurfacePool() {
+	clear();
+}
+
+void SurfacePool::clear() {
+	for (int i = 0; i < kPoolBuckets; i++) {
+		for (uint j = 0; j < _free[i].size(); j++)
+			destroySurface(_free[i][j]);
+
+		_free[i].clear();
+	}
+}
+
+int SurfacePool::getBucket(uint32 size) {
+	int bucket = 0;
+
+	while (bucket < kPoolBuckets && (1u << (bucket + kPoolMinShift)) < size)
+		bucket++;
+
+	return bucket < kPoolBuckets ? bucket : -1;
+}
+
+void SurfacePool::destroySurface(Graphics::Surface *surface) {
+	delete[] (byte *)surface->getPixels();
+	delete surface;
+}
+
+Graphics::Surface *SurfacePool::acquire(uint16 width, uint16 height, uint16 pitch) {
+	uint32 size = MAX<uint32>(pitch * height, 1);
+	int bucket = getBucket(size);
+	Graphics::Surface *surface;
+	byte *pixels;
+
+	if (bucket >= 0 && !_free[bucket].empty()) {
+		surface = _free[bucket].back();
+		_free[bucket].pop_back();
+		pixels = (byte *)surface->getPixels();
+	} else {
+		surface = new Graphics::Surface;
+		pixels = new byte[bucket >= 0 ? 1u << (bucket + kPoolMinShift) : size];
+	}
+
+	surface->init(width, height, pitch, pixels, Graphics::PixelFormat::createFormatCLUT8());
+
+	return surface;
+}
+
+void SurfacePool::release(Graphics::Surface *surface) {
+	if (!surface)
+		return;
+
+	//Same size, same bucket it was taken from
+	int bucket = getBucket(MAX<uint32>(surface->pitch * surface->h, 1));
+
+	if (bucket < 0 || _free[bucket].size() >= kPoolMaxFree) {
+		destroySurface(surface);
+		return;
+	}
+
+	_free[bucket].push_back(surface);
+}
+
+} // End of namespace Director
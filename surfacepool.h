@@ -0,0 +1,60 @@
+/* ScummVM - Graphic Adventure Engine
+ *
+ * ScummVM is the legal property of its developers, whose names
+ * are too numerous to list here. Please refer to the COPYRIGHT
+ * file distributed with this source distribution.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+ *
+ */
+
+#ifndef DIRECTOR_SURFACEPOOL_H
+#define DIRECTOR_SURFACEPOOL_H
+
+#include "common/array.h"
+#include "graphics/surface.h"
+
+namespace Director {
+
+// Smallest and largest pooled buffers are 1 << kPoolMinShift and
+// 1 << kPoolMaxShift bytes, bigger requests are not pooled
+enum {
+	kPoolMinShift = 8,
+	kPoolMaxShift = 22,
+	kPoolBuckets = kPoolMaxShift - kPoolMinShift + 1,
+	kPoolMaxFree = 8 // spare buffers kept per bucket
+};
+
+// 8-bit surfaces for decoded cast bitmaps, recycled by buffer size so
+// decoding sprites every frame does not allocate
+class SurfacePool {
+public:
+	SurfacePool();
+	~SurfacePool();
+
+	Graphics::Surface *acquire(uint16 width, uint16 height, uint16 pitch);
+	void release(Graphics::Surface *surface);
+	void clear();
+
+private:
+	static int getBucket(uint32 size);
+	static void destroySurface(Graphics::Surface *surface);
+
+	Common::Array<Graphics::Surface *> _free[kPoolBuckets];
+};
+
+} // End of namespace Director
+
+#endif
@@ -0,0 +1,522 @@
+/* ScummVM - Graphic Adventure Engine
+ *
+ * ScummVM is the legal property of its developers, whose names
+ * are too numerous to list here. Please refer to the COPYRIGHT
+ * file distributed with this source distribution.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+ *
+ */
+
+#include "common/debug.h"
+#include "common/system.h"
+#include "common/textconsole.h"
+#include "common/util.h"
+
+#include "director/director.h"
+#include "director/profile.h"
+#include "director/score.h"
+
+namespace Director {
+
+// Sizes in pixels of the blinds, checkerboard cells, strips and dissolve boxes
+enum {
+	kTransBlindSize = 16,
+	kTransCheckerSize = 16,
+	kTransStripSize = 16,
+	kTransBoxSize = 16,
+	kTransPatternSize = 4,
+	kTransBoxCount = 32, // boxy rects split each stage side in that many parts
+	kTransDissolveCellUploads = 256 // steps with fewer cells upload each one
+};
+
+// Maximal length Galois LFSR taps, indexed by the register width
+static const uint32 lfsrTaps[] = {
+	0, 0, 0x3, 0x6, 0xC, 0x14, 0x30, 0x60, 0xB8, 0x110, 0x240, 0x500, 0x829,
+	0x100D, 0x2015, 0x6000, 0xD008, 0x12000, 0x20400, 0x40023, 0x90000,
+	0x140000, 0x300000, 0x420000, 0xE10000
+};
+
+void Frame::playTransition(Score *score) {
+	uint16 duration = _transDuration * 250; // _transDuration in 1/4 of sec
+	duration = (duration == 0 ? 250 : duration); // director support transition duration = 0, but animation play like value = 1, idk.
+
+	uint16 steps = (_transChunkSize == 0 ? 1 : _transChunkSize); //equal 1 step
+
+	score->startTransition(_transType, duration, steps);
+}
+
+void Score::startTransition(TransitionType type, uint32 duration, uint16 steps) {
+	switch (type) {
+	case kTransDissolvePixelsFast:
+	case kTransDissolveBoxyRects:
+	case kTransDissolveBoxySquares:
+	case kTransDissolvePatterns:
+	case kTransRandomRows:
+	case kTransRandomColumns:
+	case kTransDissolveBitsTrans:
+	case kTransDissolvePixels:
+	case kTransDissolveBits:
+		//Dissolves advance on every 60Hz tick, whatever the chunk size is
+		steps = MAX<uint32>(1, duration * 60 / 1000);
+		break;
+	default:
+		break;
+	}
+
+	_transition.type = type;
+	_transition.startTime = g_system->getMillis();
+	_transition.duration = duration;
+	_transition.steps = steps;
+	_transition.stepsDone = 0;
+	_transition.active = true;
+}
+
+void Score::stepTransition() {
+	if (!_transition.active)
+		return;
+
+	ScopedPhaseTimer timer(_vm->getProfiler(), kPhaseTransition);
+
+	uint32 elapsed = g_system->getMillis() - _transition.startTime;
+	uint16 step;
+
+	if (elapsed >= _transition.duration)
+		step = _transition.steps;
+	else
+		step = elapsed * _transition.steps / _transition.duration;
+
+	if (step == _transition.stepsDone)
+		return;
+
+	drawTransitionStep(_transition.stepsDone, step);
+	_screenChanged = true;
+
+	_transition.stepsDone = step;
+
+	if (step == _transition.steps)
+		_transition.active = false;
+}
+
+static int transScale(int length, uint16 step, uint16 steps) {
+	return length * step / steps;
+}
+
+// A width x height rect centered on the stage. Both edges come from the
+// same rounded left edge, so odd stage sizes don't lose a row or column
+static Common::Rect centeredRect(int w, int h, int width, int height) {
+	int left = (w - width) / 2;
+	int top = (h - height) / 2;
+
+	return Common::Rect(left, top, left + width, top + height);
+}
+
+void Score::drawTransitionStep(uint16 prev, uint16 cur) {
+	int w = _surface->w;
+	int h = _surface->h;
+	uint16 steps = _transition.steps;
+
+	int xPrev = transScale(w, prev, steps);
+	int xCur = transScale(w, cur, steps);
+	int yPrev = transScale(h, prev, steps);
+	int yCur = transScale(h, cur, steps);
+
+	switch (_transition.type) {
+	case kTransWipeRight:
+		transRevealRect(Common::Rect(xPrev, 0, xCur, h));
+		break;
+	case kTransWipeLeft:
+		transRevealRect(Common::Rect(w - xCur, 0, w - xPrev, h));
+		break;
+	case kTransWipeDown:
+		transRevealRect(Common::Rect(0, yPrev, w, yCur));
+		break;
+	case kTransWipeUp:
+		transRevealRect(Common::Rect(0, h - yCur, w, h - yPrev));
+		break;
+
+	case kTransCenterOutHorizontal:
+		transRevealRing(centeredRect(w, h, xPrev, h), centeredRect(w, h, xCur, h));
+		break;
+	case kTransEdgesInHorizontal:
+		transRevealRing(centeredRect(w, h, w - xCur, h), centeredRect(w, h, w - xPrev, h));
+		break;
+	case kTransCenterOutVertical:
+		transRevealRing(centeredRect(w, h, w, yPrev), centeredRect(w, h, w, yCur));
+		break;
+	case kTransEdgesInVertical:
+		transRevealRing(centeredRect(w, h, w, h - yCur), centeredRect(w, h, w, h - yPrev));
+		break;
+	case kTransCenterOutSquare:
+	case kTransZoomOpen:
+		transRevealRing(centeredRect(w, h, xPrev, yPrev), centeredRect(w, h, xCur, yCur));
+		break;
+	case kTransEdgesInSquare:
+	case kTransZoomClose:
+		transRevealRing(centeredRect(w, h, w - xCur, h - yCur), centeredRect(w, h, w - xPrev, h - yPrev));
+		break;
+
+	case kTransPushLeft:
+		transShift(*_backSurface, -xCur, 0);
+		transShift(*_surface, w - xCur, 0);
+		break;
+	case kTransPushRight:
+		transShift(*_backSurface, xCur, 0);
+		transShift(*_surface, xCur - w, 0);
+		break;
+	case kTransPushDown:
+		transShift(*_backSurface, 0, yCur);
+		transShift(*_surface, 0, yCur - h);
+		break;
+	case kTransPushUp:
+		transShift(*_backSurface, 0, -yCur);
+		transShift(*_surface, 0, h - yCur);
+		break;
+
+	case kTransRevealUp:
+		transRevealUnder(0, -yPrev, 0, -yCur);
+		break;
+	case kTransRevealUpRight:
+		transRevealUnder(xPrev, -yPrev, xCur, -yCur);
+		break;
+	case kTransRevealRight:
+		transRevealUnder(xPrev, 0, xCur, 0);
+		break;
+	case kTransRevealDown:
+		transRevealUnder(0, yPrev, 0, yCur);
+		break;
+	case kTransRevealDownRight:
+		transRevealUnder(xPrev, yPrev, xCur, yCur);
+		break;
+	case kTransRevealDownLeft:
+		transRevealUnder(-xPrev, yPrev, -xCur, yCur);
+		break;
+	case kTransRevealLeft:
+		transRevealUnder(-xPrev, 0, -xCur, 0);
+		break;
+	case kTransRevealUpLeft:
+		transRevealUnder(-xPrev, -yPrev, -xCur, -yCur);
+		break;
+
+	case kTransCoverDown:
+		transShift(*_surface, 0, yCur - h);
+		break;
+	case kTransCoverDownLeft:
+		transShift(*_surface, w - xCur, yCur - h);
+		break;
+	case kTransCoverDownRight:
+		transShift(*_surface, xCur - w, yCur - h);
+		break;
+	case kTransCoverLeft:
+		transShift(*_surface, w - xCur, 0);
+		break;
+	case kTransCoverRight:
+		transShift(*_surface, xCur - w, 0);
+		break;
+	case kTransCoverUp:
+		transShift(*_surface, 0, h - yCur);
+		break;
+	case kTransCoverUpLeft:
+		transShift(*_surface, w - xCur, h - yCur);
+		break;
+	case kTransCoverUpRight:
+		transShift(*_surface, xCur - w, h - yCur);
+		break;
+
+	case kTransTypeVenitianBlind:
+		for (int y = 0; y < h; y += kTransBlindSize)
+			transRevealRect(Common::Rect(0, y + transScale(kTransBlindSize, prev, steps), w, y + transScale(kTransBlindSize, cur, steps)));
+		break;
+	case kTransVerticalBinds:
+		for (int x = 0; x < w; x += kTransBlindSize)
+			transRevealRect(Common::Rect(x + transScale(kTransBlindSize, prev, steps), 0, x + transScale(kTransBlindSize, cur, steps), h));
+		break;
+	case kTransTypeCheckerboard:
+		{
+			// Even cells are revealed during the first half, odd cells during the second one
+			for (int phase = 0; phase < 2; phase++) {
+				int from = transScale(kTransCheckerSize, CLIP<int>(prev * 2 - phase * steps, 0, steps), steps);
+				int to = transScale(kTransCheckerSize, CLIP<int>(cur * 2 - phase * steps, 0, steps), steps);
+
+				if (from == to)
+					continue;
+
+				for (int y = 0; y < h; y += kTransCheckerSize)
+					for (int x = 0; x < w; x += kTransCheckerSize)
+						if (((x + y) / kTransCheckerSize) % 2 == phase)
+							transRevealRect(Common::Rect(x, y + from, x + kTransCheckerSize, y + to));
+			}
+		}
+		break;
+
+	case kTransTypeStripsBottomBuildLeft:
+		transRevealStrips(prev, cur, true, true, true);
+		break;
+	case kTransTypeStripsBottomBuildRight:
+		transRevealStrips(prev, cur, true, true, false);
+		break;
+	case kTransTypeStripsTopBuildLeft:
+		transRevealStrips(prev, cur, true, false, true);
+		break;
+	case kTransTypeStripsTopBuildRight:
+		transRevealStrips(prev, cur, true, false, false);
+		break;
+	case kTransTypeStripsLeftBuildDown:
+		transRevealStrips(prev, cur, false, false, false);
+		break;
+	case kTransTypeStripsLeftBuildUp:
+		transRevealStrips(prev, cur, false, false, true);
+		break;
+	case kTransTypeStripsRightBuildDown:
+		transRevealStrips(prev, cur, false, true, false);
+		break;
+	case kTransTypeStripsRightBuildUp:
+		transRevealStrips(prev, cur, false, true, true);
+		break;
+
+	case kTransDissolvePixelsFast:
+	case kTransDissolvePixels:
+	case kTransDissolveBits:
+	case kTransDissolveBitsTrans:
+		transDissolve(prev, cur, 1, 1);
+		break;
+	case kTransDissolveBoxyRects:
+		transDissolve(prev, cur, MAX(1, w / kTransBoxCount), MAX(1, h / kTransBoxCount));
+		break;
+	case kTransDissolveBoxySquares:
+		transDissolve(prev, cur, kTransBoxSize, kTransBoxSize);
+		break;
+	case kTransDissolvePatterns:
+		transDissolve(prev, cur, kTransPatternSize, kTransPatternSize);
+		break;
+	case kTransRandomRows:
+		transDissolve(prev, cur, w, 1);
+		break;
+	case kTransRandomColumns:
+		transDissolve(prev, cur, 1, h);
+		break;
+
+	default:
+		warning("Unhandled transition type %d %d %d", _transition.type, _transition.duration, _transition.steps);
+		transRevealRect(Common::Rect(w, h));
+		_transition.active = false;
+		break;
+	}
+}
+
+void Score::transCopyRect(const Graphics::ManagedSurface &src, const Common::Rect &dst, int srcX, int srcY) {
+	Common::Rect r = dst;
+	r.clip(Common::Rect(_surface->w, _surface->h));
+
+	if (r.isEmpty())
+		return;
+
+	srcX += r.left - dst.left;
+	srcY += r.top - dst.top;
+
+	g_system->copyRectToScreen(src.getBasePtr(srcX, srcY), src.pitch, r.left, r.top, r.width(), r.height());
+}
+
+void Score::transRevealRect(const Common::Rect &r) {
+	transCopyRect(*_surface, r, r.left, r.top);
+}
+
+void Score::transRevealRing(const Common::Rect &inner, const Common::Rect &outer) {
+	if (inner.isEmpty()) {
+		transRevealRect(outer);
+		return;
+	}
+
+	transRevealRect(Common::Rect(outer.left, outer.top, outer.right, inner.top));
+	transRevealRect(Common::Rect(outer.left, inner.bottom, outer.right, outer.bottom));
+	transRevealRect(Common::Rect(outer.left, inner.top, inner.left, inner.bottom));
+	transRevealRect(Common::Rect(inner.right, inner.top, outer.right, inner.bottom));
+}
+
+void Score::transShift(const Graphics::ManagedSurface &src, int dx, int dy) {
+	Common::Rect r(src.w, src.h);
+	r.translate(dx, dy);
+	r.clip(Common::Rect(_surface->w, _surface->h));
+
+	if (r.isEmpty())
+		return;
+
+	transCopyRect(src, r, r.left - dx, r.top - dy);
+}
+
+void Score::transRevealUnder(int dxPrev, int dyPrev, int dxCur, int dyCur) {
+	int w = _surface->w;
+	int h = _surface->h;
+
+	// The previous frame slides away, only the strips it has just uncovered need the new frame
+	transShift(*_backSurface, dxCur, dyCur);
+
+	if (dxCur > 0)
+		transRevealRect(Common::Rect(dxPrev, 0, dxCur, h));
+	else if (dxCur < 0)
+		transRevealRect(Common::Rect(w + dxCur, 0, w + dxPrev, h));
+
+	if (dyCur > 0)
+		transRevealRect(Common::Rect(0, dyPrev, w, dyCur));
+	else if (dyCur < 0)
+		transRevealRect(Common::Rect(0, h + dyCur, w, h + dyPrev));
+}
+
+void Score::transRevealStrips(uint16 prev, uint16 cur, bool vertical, bool fromEnd, bool reverseOrder) {
+	int w = _surface->w;
+	int h = _surface->h;
+	int length = vertical ? h : w;
+	int count = ((vertical ? w : h) + kTransStripSize - 1) / kTransStripSize;
+
+	// Strips are built one after another, so the progress runs over all of them
+	int from = transScale(count * length, prev, _transition.steps);
+	int to = transScale(count * length, cur, _transition.steps);
+
+	for (int strip = from / length; strip < count && strip * length < to; strip++) {
+		int a = MAX(from - strip * length, 0);
+		int b = MIN(to - strip * length, length);
+		int pos = (reverseOrder ? count - 1 - strip : strip) * kTransStripSize;
+
+		if (fromEnd) {
+			int tmp = length - b;
+			b = length - a;
+			a = tmp;
+		}
+
+		if (vertical)
+			transRevealRect(Common::Rect(pos, a, pos + kTransStripSize, b));
+		else
+			transRevealRect(Common::Rect(a, pos, b, pos + kTransStripSize));
+	}
+}
+
+DissolveTable *Score::getDissolveTable(uint16 cellWidth, uint16 cellHeight) {
+	uint16 w = _surface->w;
+	uint16 h = _surface->h;
+
+	for (uint i = 0; i < _dissolveTables.size(); i++) {
+		DissolveTable *t = _dissolveTables[i];
+
+		if (t->width == w && t->height == h && t->cellWidth == cellWidth && t->cellHeight == cellHeight)
+			return t;
+	}
+
+	DissolveTable *t = new DissolveTable;
+	t->width = w;
+	t->height = h;
+	t->cellWidth = cellWidth;
+	t->cellHeight = cellHeight;
+	t->cellsX = (w + cellWidth - 1) / cellWidth;
+	t->cellsY = (h + cellHeight - 1) / cellHeight;
+
+	uint32 count = t->cellsX * t->cellsY;
+	uint bits = 2;
+
+	while (bits < ARRAYSIZE(lfsrTaps) - 1 && (1u << bits) - 1 < count)
+		bits++;
+
+	// Walk the register through all its states, each one is a cell index + 1
+	t->cells.reserve(count);
+	uint32 state = 1;
+
+	do {
+		if (state - 1 < count) {
+			uint32 x = (state - 1) % t->cellsX * cellWidth;
+			uint32 y = (state - 1) / t->cellsX * cellHeight;
+
+			t->cells.push_back(y * _surface->pitch + x);
+		}
+
+		state = (state >> 1) ^ ((state & 1) ? lfsrTaps[bits] : 0);
+	} while (state != 1);
+
+	debug(3, "Dissolve table %dx%d, cell %dx%d: %d cells", w, h, cellWidth, cellHeight, t->cells.size());
+
+	_dissolveTables.push_back(t);
+
+	return t;
+}
+
+void Score::transDissolve(uint16 prev, uint16 cur, uint16 cellWidth, uint16 cellHeight) {
+	DissolveTable *t = getDissolveTable(cellWidth, cellHeight);
+
+	// _backSurface mirrors the screen and gets the next slice of cells of the new stage
+	assert(_backSurface->pitch == _surface->pitch);
+
+	uint32 from = (uint64)t->cells.size() * prev / _transition.steps;
+	uint32 to = (uint64)t->cells.size() * cur / _transition.steps;
+	const byte *src = (const byte *)_surface->getPixels();
+	byte *dst = (byte *)_backSurface->getPixels();
+	const uint32 *cells = &t->cells[0];
+
+	uint16 pitch = _surface->pitch;
+
+	if (cellWidth == 1 && cellHeight == 1) {
+		for (uint32 i = from; i < to; i++)
+			dst[cells[i]] = src[cells[i]];
+	} else {
+		for (uint32 i = from; i < to; i++) {
+			uint32 x = cells[i] % pitch;
+			uint32 y = cells[i] / pitch;
+			uint16 cw = MIN<uint32>(cellWidth, t->width - x);
+			uint16 ch = MIN<uint32>(cellHeight, t->height - y);
+
+			for (uint16 j = 0; j < ch; j++)
+				memcpy(dst + cells[i] + j * pitch, src + cells[i] + j * pitch, cw);
+		}
+	}
+
+	//Only what this step revealed goes to the screen: the cells themselves
+	//when there are few, otherwise the span they cover on each row of cells
+	if (to - from <= kTransDissolveCellUploads) {
+		for (uint32 i = from; i < to; i++) {
+			uint32 x = cells[i] % pitch;
+			uint32 y = cells[i] / pitch;
+
+			g_system->copyRectToScreen(dst + cells[i], pitch, x, y,
+				MIN<uint32>(cellWidth, t->width - x), MIN<uint32>(cellHeight, t->height - y));
+		}
+
+		return;
+	}
+
+	t->spanLeft.resize(t->cellsY);
+	t->spanRight.resize(t->cellsY);
+
+	for (uint16 row = 0; row < t->cellsY; row++) {
+		t->spanLeft[row] = t->width;
+		t->spanRight[row] = 0;
+	}
+
+	for (uint32 i = from; i < to; i++) {
+		uint16 x = cells[i] % pitch;
+		uint16 row = cells[i] / pitch / cellHeight;
+
+		t->spanLeft[row] = MIN(t->spanLeft[row], x);
+		t->spanRight[row] = MAX<uint16>(t->spanRight[row], MIN<uint32>(x + cellWidth, t->width));
+	}
+
+	for (uint16 row = 0; row < t->cellsY; row++) {
+		if (t->spanLeft[row] >= t->spanRight[row])
+			continue;
+
+		uint16 y = row * cellHeight;
+
+		g_system->copyRectToScreen(dst + y * pitch + t->spanLeft[row], pitch, t->spanLeft[row], y,
+			t->spanRight[row] - t->spanLeft[row], MIN<uint16>(cellHeight, t->height - y));
+	}
+}
+
+} // End of namespace Director